@@ -0,0 +1,79 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "iridium/JobUnitQueue.hpp"
+
+///
+/// Сравнение хранилищ JobUnitQueue при одновременной работе нескольких
+/// производителей и потребителей.
+///
+/// Производители помещают в очередь по jobs заданий, потребители извлекают
+/// задания до получения всех. Печатается пропускная способность очереди
+/// при извлечении по одному заданию и пакетами (drain()).
+///
+
+template <class Queue> double run(Queue& queue, unsigned producers,
+                                  unsigned consumers, unsigned long jobs,
+                                  size_t batch)
+{
+  const unsigned long total = producers * jobs;
+  std::atomic<unsigned long> consumed(0);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned p = 0; p < producers; p++)
+    threads.push_back(std::thread([&queue, jobs]() {
+      // нулевое задание означает пустую очередь
+      for (unsigned long i = 1; i <= jobs; i++) queue.put(i);
+    }));
+  for (unsigned c = 0; c < consumers; c++)
+    threads.push_back(std::thread([&queue, &consumed, total, batch]() {
+      std::vector<unsigned long> out;
+      out.reserve(batch);
+      unsigned long job;
+      while (consumed.load() < total)
+      {
+        if (batch > 1)
+        {
+          out.clear();
+          size_t n = queue.drain(out, batch);
+          if (n) consumed += n;
+            else std::this_thread::yield();
+        }
+        else if (queue.pop_wait_for(job, std::chrono::milliseconds(1)))
+          consumed++;
+      }
+    }));
+  for (auto& t: threads) t.join();
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return total / elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc > 4)
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " [producers [consumers [jobs per producer]]]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  unsigned producers = (argc > 1) ? std::atoi(argv[1]) : 8,
+           consumers = (argc > 2) ? std::atoi(argv[2]) : 2;
+  unsigned long jobs = (argc > 3) ? std::atol(argv[3]) : 200000;
+  JobUnitQueue<unsigned long> list;
+  JobUnitQueue<unsigned long, JobRingStorage<unsigned long> > ring(4096);
+  std::cout << producers << " producers, " << consumers << " consumers, "
+            << jobs << " jobs per producer" << std::endl;
+  std::cout << "list: " << run(list, producers, consumers, jobs, 1)
+            << " jobs/s" << std::endl;
+  std::cout << "ring: " << run(ring, producers, consumers, jobs, 1)
+            << " jobs/s" << std::endl;
+  std::cout << "list, batches of 64: " << run(list, producers, consumers, jobs, 64)
+            << " jobs/s" << std::endl;
+  std::cout << "ring, batches of 64: " << run(ring, producers, consumers, jobs, 64)
+            << " jobs/s" << std::endl;
+  return EXIT_SUCCESS;
+}
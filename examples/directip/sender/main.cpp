@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <boost/asio/io_service.hpp>
@@ -23,6 +24,18 @@ void OnResult(int16_t res)
   std::cerr << "Transmit status: " << res << std::endl;
 }
 
+void OnReport(const Iridium::SbdTransmitter::TransmitReport& report)
+{
+  std::clog << "Message " << report.messageId << " to " << report.imei
+            << ": auto ID reference " << report.autoRef << ", queue position "
+            << report.queuePosition << ", attempts " << report.attempts
+            << ", delivered in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 report.completed - report.posted
+               ).count()
+            << " ms" << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
   if (argc != 2)
@@ -47,6 +60,7 @@ int main(int argc, char* argv[])
   std::vector<boost::signals2::connection> transmitterConnections;
   transmitterConnections.push_back(transmitter.OnErrorConnect(&OnError));
   transmitterConnections.push_back(transmitter.OnTransmitResultConnect(&OnResult));
+  transmitterConnections.push_back(transmitter.OnTransmitReportConnect(&OnReport));
   while (!shutdown)
   {
     transmitter.start();
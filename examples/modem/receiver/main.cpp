@@ -14,49 +14,71 @@
 const char* modemDevice = "/dev/ttyS0";
 // таймаут ожидания сброса lock-файла, миллисекунды
 const unsigned int LockFileTimeout = 500;
-// проверка входящего сообщения раз в секунду
-const unsigned int loopTimeout = 1;
 
 boost::asio::io_service io_service;
 Iridium::Modem modem(io_service, modemDevice);
 boost::asio::steady_timer timer(io_service);
+// сеанс SBD выполняется
+bool sessionActive = false;
+// получен вызов SBDRING, сеанс еще не выполнен
+bool ringPending = false;
 
-void loop(const boost::system::error_code& error)
+void session(bool answer);
+
+void printMessage(const boost::system::error_code& error,
+                  const std::vector<char>& payload)
+{
+  if (error)
+  {
+    std::cerr << "Can't read message: " << error.message() << std::endl;
+    return;
+  }
+  std::clog << "Message received (" << payload.size() << " bytes): ";
+  for (char c: payload)
+    if (c < ' ')
+      std::clog << " 0x" << std::hex << int(c) << std::dec << " ";
+      else std::clog << c;
+  std::clog << std::endl;
+}
+
+void sessionComplete(const boost::system::error_code& error,
+                     const Iridium::Modem::SbdSessionStatus& sessionStatus)
 {
+  sessionActive = false;
   if (error == boost::asio::error::operation_aborted) return;
-  if (!modem.SbdClearBuffers(Iridium::Modem::eClearMObuffer))
+  if (error)
   {
-    std::cerr << "Can't clear MO message buffer." << std::endl;
-    timer.expires_from_now(std::chrono::seconds(loopTimeout));
-    timer.async_wait(&loop);
+    std::cerr << "SBD session failed: " << error.message() << std::endl;
     return;
   }
-  try
+  if (sessionStatus.mt_status == 1) modem.async_read_message(&printMessage);
+  if (sessionStatus.mt_status == 2)
   {
-    Iridium::Modem::SbdSessionStatus sessionStatus = modem.DoSbdSession(false);
-    if (sessionStatus.mt_status == 1)
-    {
-      std::vector<char> payload;
-      modem.ReadMessage(payload);
-      std::clog << "Message received (" << payload.size() << " bytes): ";
-      for (char c: payload)
-        if (c < ' ')
-          std::clog << " 0x" << std::hex << int(c) << std::dec << " ";
-          else std::clog << c;
-      std::clog << std::endl;
-    }
-    if (sessionStatus.mt_status == 2)
-    {
-      std::cerr << "An error occurred while attempting to perform a mailbox check or receive a message from the GSS."
-                << std::endl;
-    }
+    std::cerr << "An error occurred while attempting to perform a mailbox check or receive a message from the GSS."
+              << std::endl;
   }
-  catch (std::runtime_error& e)
+  // в очереди шлюза остались сообщения
+  if (sessionStatus.mt_queue || ringPending) session(ringPending);
+}
+
+///
+/// Выполнить сеанс SBD, как только позволит сеть.
+///
+/// @param [in] answer Сеанс -- ответ на вызов SBDRING.
+///
+void session(bool answer)
+{
+  ringPending = ringPending || answer;
+  if (sessionActive) return;
+  // сеть недоступна -- ждем +CIEV
+  if (modem.serviceAvailable() == 0)
   {
-    std::cerr << "Can't get SBD status: " << e.what() << std::endl;
+    std::clog << "Network service unavailable, session deferred." << std::endl;
+    return;
   }
-  timer.expires_from_now(std::chrono::seconds(loopTimeout));
-  timer.async_wait(&loop);
+  sessionActive = true;
+  ringPending = false;
+  modem.async_do_sbd_session(answer, &sessionComplete);
 }
 
 int main()
@@ -94,6 +116,16 @@ int main()
     std::cout << std::endl << "Device " << modemDevice << " acquired."
               << std::endl;
     lockfile.create();
+    modem.setRingCallback([]() {
+      std::clog << "Ring alert received." << std::endl;
+      session(true);
+    });
+    modem.setIndicatorCallback([](Iridium::Modem::EIndicator indicator,
+                                  uint8_t value) {
+      if ((indicator == Iridium::Modem::eServiceIndicator) && value &&
+          ringPending)
+        session(true);
+    });
     try
     {
       modem.Open();
@@ -103,7 +135,16 @@ int main()
       std::cerr << "Can't open modem: " << e.what() << std::endl;
       return EXIT_FAILURE;
     }
-    loop(boost::system::error_code());
+    if (!modem.SbdClearBuffers(Iridium::Modem::eClearMObuffer))
+      std::cerr << "Can't clear MO message buffer." << std::endl;
+    if (!modem.EnableIndicatorEvents(true, true, false) ||
+        !modem.SbdEnableRingAlert(true))
+    {
+      std::cerr << "Can't enable ring alerts." << std::endl;
+      return EXIT_FAILURE;
+    }
+    // сообщения, поступившие на шлюз до включения вызовов
+    session(false);
     io_service.run();
   }
   return EXIT_SUCCESS;
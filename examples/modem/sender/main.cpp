@@ -6,6 +6,7 @@
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include "iridium/Modem.hpp"
+#include "iridium/MoOutbox.hpp"
 #include "LockFile.hpp"
 
 #define UNUSED(x) (void)x;
@@ -24,6 +25,7 @@ int main(int argc, char* argv[])
   bool shutdown = false;
   boost::asio::io_service io_service;
   Iridium::Modem modem(io_service, modemDevice);
+  Iridium::MoOutbox outbox(io_service, modem);
   boost::asio::signal_set stopSignals(io_service, SIGINT, SIGTERM, SIGQUIT);
   stopSignals.async_wait(
   [&](const boost::system::error_code& error, int signal) {
@@ -31,6 +33,7 @@ int main(int argc, char* argv[])
     // ignore signal handling cancellation
     if (error == boost::asio::error::operation_aborted) return;
     shutdown = true;
+    outbox.stop();
     modem.Close();
   });
   LockFile lockfile(modemDevice);
@@ -63,70 +66,34 @@ int main(int argc, char* argv[])
     std::cerr << "Can't open modem: " << e.what() << std::endl;
     return EXIT_FAILURE;
   }
-  uint8_t netstatus = 0;
-  if (!modem.NetGetStatus(netstatus))
-  {
-    std::cerr << "Can't get network status." << std::endl;
-    return EXIT_FAILURE;
-  }
-  // registered in home network or roaming
-  if ((netstatus != 1) && (netstatus != 5))
-  {
-    std::cerr << "ISU not ready (" << int(netstatus) << ")." << std::endl;
-    return EXIT_FAILURE;
-  }
-  modem.GetSignalQuality(netstatus);
-  if (!netstatus)
-  {
-    std::cerr << "Signal quality too low." << std::endl;
-    return EXIT_FAILURE;
-  }
-  if (!modem.SbdClearBuffers(Iridium::Modem::eClearMObuffer))
-  {
-    std::cerr << "Can't clear MO message buffer." << std::endl;
-    return EXIT_FAILURE;
-  }
   std::vector<char> payload(argv[1], argv[1] + std::strlen(argv[1]));
+  bool delivered = false;
+  // сеансы повторяются в открытом модеме, пока сообщение не будет передано
+  outbox.setDeliveryCallback(
+  [&](const Iridium::MoOutbox::Delivery& delivery) {
+    std::cout << "Message transferred successfully: MOMSN = "
+              << delivery.momsn << ", attempts " << delivery.attempts
+              << "." << std::endl;
+    delivered = true;
+    outbox.stop();
+    modem.Close();
+    stopSignals.cancel();
+  });
+  outbox.setMtCallback([](const std::vector<char>& message) {
+    std::cout << "MT message received, " << message.size() << " bytes."
+              << std::endl;
+  });
   try
   {
-    uint8_t res = modem.WriteMessage(payload);
-    if (res)
-    {
-      std::cerr << "Store message error: ";
-      if (res == 1) std::cerr << "write timeout";
-      if (res == 2) std::cerr << "bad CRC";
-      // must be exception
-      if (res == 3) std::cerr << "size is not correct";
-      if (res > 3) std::cerr << int(res);
-      std::cerr << std::endl;
-      return EXIT_FAILURE;
-    }
+    outbox.post(payload);
   }
   catch (std::runtime_error& e)
   {
     std::cerr << "Store message error: " << e.what() << std::endl;
     return EXIT_FAILURE;
   }
-  Iridium::Modem::SbdSessionStatus sessionStatus;
-  std::cout << "SBD session... " << std::flush;
-  try
-  {
-    sessionStatus = modem.DoSbdSession(false);
-    std::cout << "status:" << std::endl
-              << "  MO status = " << int(sessionStatus.mo_status) << std::endl
-              << "  MOMSN = " << sessionStatus.momsn << std::endl
-              << "  MT status = " << int(sessionStatus.mt_status) << std::endl
-              << "  MTMSN = " << sessionStatus.mtmsn << std::endl
-              << "  MT message length = " << sessionStatus.mt_message_len << std::endl
-              << "  Waiting messages " << int(sessionStatus.mt_queue) << std::endl;
-    if (sessionStatus.mo_status < 5)
-      std::cout << "Message transferred successfully." << std::endl;
-      else std::cout << "Message transfer FAILURE." << std::endl;
-  }
-  catch (std::runtime_error& e)
-  {
-    std::cout << " error: " << e.what() << std::endl;
-    return EXIT_FAILURE;
-  }
-  return (sessionStatus.mo_status < 5) ? EXIT_SUCCESS : EXIT_FAILURE;
+  std::cout << "SBD session... " << std::endl;
+  outbox.start();
+  io_service.run();
+  return delivered ? EXIT_SUCCESS : EXIT_FAILURE;
 }
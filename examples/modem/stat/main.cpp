@@ -25,13 +25,15 @@ void worker(const boost::system::error_code& error)
   time_t rawtime;
   struct tm* timeinfo;
   char buffer[20] = { 0 };
-std::clog << "worker() before NetGetStatus()" << std::endl;
-std::clog << std::flush;
-  modem.NetGetStatus(netstatus);
-std::clog << "worker() after NetGetStatus()" << std::endl;
-std::clog << std::flush;
-  // registered in home network or roaming
-  if ((netstatus == 1) || (netstatus == 5)) modem.GetSignalQuality(signalQty);
+  // регистрация, сигнал и состояние SBD за один обмен с модемом
+  Iridium::Modem::StatusSnapshot status;
+  if (modem.GetStatusSnapshot(status))
+  {
+    netstatus = status.net_status;
+    // registered in home network or roaming
+    if ((netstatus == 1) || (netstatus == 5))
+      signalQty = status.signal_quality;
+  }
   time(&rawtime);
   timeinfo = localtime(&rawtime);
   strftime(buffer, sizeof(buffer), "%F %T",timeinfo);
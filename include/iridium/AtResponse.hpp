@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace Iridium {
+
+///
+/// Ответ модема на AT-команду.
+///
+/// Объект не владеет данными: это представление участка буфера приема,
+/// действительное, пока буфер не изменен. Разбор выполняется на месте, без
+/// выделения памяти и без исключений.
+///
+/// Информационные строки ответа -- все, кроме пустых, эхо команды
+/// (начинается с "AT") и итогового кода OK. Пробелы и '\r' по краям строки
+/// не учитываются.
+///
+class AtResponse
+{
+  public:
+    AtResponse(): m_data(nullptr), m_size(0) {}
+    AtResponse(const char* data, size_t size): m_data(data), m_size(size) {}
+
+    inline const char* data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+
+    ///
+    /// Найти конец ответа: ожидаемую строку или итоговый код ERROR.
+    ///
+    /// @param [in] data Принятые данные.
+    /// @param [in] size Длина принятых данных.
+    /// @param [in] expected Ожидаемая строка, например "OK\r\n".
+    /// @param [out] length Длина ответа, включая найденную строку.
+    /// @return false, если ответ еще не принят полностью.
+    ///
+    static bool findEnd(const char* data, size_t size, const char* expected,
+                        size_t& length);
+    ///
+    /// Разобрать числовые поля вида "1, -2,3".
+    ///
+    /// @param [in] begin Начало полей.
+    /// @param [in] end Конец полей.
+    /// @param [out] values Значения полей.
+    /// @param [in] max Наибольшее количество полей.
+    /// @param [out] count Количество разобранных полей.
+    /// @return false, если поле не является числом, выходит за пределы
+    ///         int32_t или полей больше max.
+    ///
+    static bool parseFields(const char* begin, const char* end,
+                            int32_t* values, size_t max, size_t& count);
+
+    ///
+    /// Ответ завершен итоговым кодом ERROR.
+    ///
+    bool isError() const;
+    ///
+    /// Найти первую информационную строку, начинающуюся с префикса.
+    ///
+    /// @param [in] prefix Префикс; пустая строка -- любая строка.
+    /// @param [out] begin Начало строки после префикса.
+    /// @param [out] end Конец строки.
+    ///
+    bool line(const char* prefix, const char*& begin, const char*& end) const;
+    ///
+    /// Разобрать числовые поля строки вида "+CMD: 1, 2, 3".
+    ///
+    /// @param [in] prefix Префикс строки, включая двоеточие.
+    ///
+    bool fields(const char* prefix, int32_t* values, size_t max,
+                size_t& count) const;
+    ///
+    /// Разобрать числовой код результата в первой информационной строке
+    /// (AT+SBDD, AT+SBDC, AT+SBDWB).
+    ///
+    bool resultCode(int32_t& code) const;
+
+  private:
+    const char* m_data;
+    size_t m_size;
+}; // class AtResponse
+
+} // namespace Iridium
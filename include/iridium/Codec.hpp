@@ -58,6 +58,15 @@ class Codec
     ///
     static void parse(const char* payload, size_t size, MoMessage& out);
     ///
+    /// Parse mobile terminated message.
+    ///
+    /// @param [in] payload Incoming data buffer.
+    /// @param [in] size Incoming data size.
+    /// @param [out] out New MT message.
+    /// @throw std::runtime_exception
+    ///
+    static void parse(const char* payload, size_t size, MtMessage& out);
+    ///
     /// Parse mobile terminated message confirmation message.
     ///
     /// @param [in] payload Incoming data buffer.
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace Iridium {
+
+///
+/// Набор шлюзов DirectIP с отслеживанием их исправности.
+///
+/// Шлюзы выбираются по уровню предпочтения: используются шлюзы с наименьшим
+/// уровнем, среди которых есть доступные. Среди шлюзов одного уровня
+/// нагрузка распределяется пропорционально весам (плавный взвешенный
+/// циклический выбор). Так задается как упорядоченный список (основной и
+/// резервный шлюзы на разных уровнях), так и взвешенный (на одном уровне).
+///
+/// Для каждого шлюза действует "предохранитель" (circuit breaker): после
+/// заданного количества ошибок подряд шлюз исключается из выбора (состояние
+/// eOpen). По истечении интервала восстановления через шлюз пропускается
+/// одна пробная сессия (состояние eHalfOpen); успех возвращает шлюз в
+/// работу, ошибка снова исключает его.
+///
+/// Методы класса потокобезопасны, один набор может использоваться
+/// несколькими передатчиками.
+///
+class GatewayPool: private boost::noncopyable
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t None; ///< Нет подходящего шлюза.
+    static const unsigned int DefaultFailureThreshold;
+    static const std::chrono::milliseconds DefaultOpenInterval;
+
+    ///
+    /// Состояние "предохранителя" шлюза.
+    ///
+    enum EState
+    {
+      eClosed, ///< Шлюз исправен.
+      eOpen, ///< Шлюз исключен до истечения интервала восстановления.
+      eHalfOpen ///< Выполняется пробная сессия.
+    };
+
+    ///
+    /// Адрес и параметры выбора шлюза.
+    ///
+    struct Gateway
+    {
+      std::string host, port;
+      unsigned int preference; ///< Уровень предпочтения, 0 -- наивысший.
+      unsigned int weight; ///< Вес среди шлюзов одного уровня, не менее 1.
+
+      Gateway(const std::string& h, const std::string& p,
+              unsigned int pref = 0, unsigned int w = 1):
+        host(h), port(p), preference(pref), weight(w ? w : 1)
+      {}
+    };
+
+    ///
+    /// Состояние шлюза.
+    ///
+    struct Status
+    {
+      Gateway gateway;
+      EState state;
+      unsigned int failures; ///< Количество ошибок подряд.
+      unsigned long successes; ///< Всего успешных сессий.
+      unsigned long errors; ///< Всего ошибок.
+
+      Status(const Gateway& g):
+        gateway(g), state(eClosed), failures(0), successes(0), errors(0)
+      {}
+    };
+
+    GatewayPool();
+
+    ///
+    /// Добавить шлюз.
+    ///
+    /// @return Номер шлюза в наборе.
+    ///
+    size_t add(const Gateway& gateway);
+
+    ///
+    /// Задать параметры "предохранителя".
+    ///
+    /// @param [in] threshold Количество ошибок подряд, после которого шлюз
+    ///                       исключается; не менее 1.
+    /// @param [in] interval Интервал восстановления.
+    ///
+    void setBreaker(unsigned int threshold,
+                    std::chrono::milliseconds const& interval);
+
+    ///
+    /// Выбрать шлюз для очередной сессии.
+    ///
+    /// @param [in] avoid Номер шлюза, который выбирается только при
+    ///                   отсутствии других доступных шлюзов.
+    /// @return Номер шлюза или None, если доступных шлюзов нет.
+    ///
+    /// Если выбран шлюз в состоянии eOpen, он переводится в состояние
+    /// eHalfOpen; итог сессии должен быть сообщен вызовом success() или
+    /// failure().
+    ///
+    size_t select(size_t avoid = None);
+    ///
+    /// Есть ли доступный шлюз, кроме указанного.
+    ///
+    bool available(size_t except = None) const;
+
+    ///
+    /// Сообщить об успешной сессии через шлюз.
+    ///
+    void success(size_t index);
+    ///
+    /// Сообщить об ошибке соединения или протокола при работе со шлюзом.
+    ///
+    void failure(size_t index);
+
+    ///
+    /// Адрес и параметры шлюза.
+    ///
+    /// @throw std::out_of_range
+    ///
+    Gateway gateway(size_t index) const;
+    size_t size() const;
+    ///
+    /// Состояние всех шлюзов в порядке добавления.
+    ///
+    std::vector<Status> status() const;
+
+  private:
+    struct Entry
+    {
+      Status status;
+      Clock::time_point until; ///< Окончание исключения (eOpen) или
+                               ///< пробной сессии (eHalfOpen).
+      long current; ///< Текущий вес плавного циклического выбора.
+
+      Entry(const Gateway& g): status(g), current(0) {}
+    };
+
+    ///
+    /// Доступен ли шлюз для выбора.
+    ///
+    /// Вызывается под захваченным мутексом.
+    ///
+    bool ready(const Entry& entry, Clock::time_point now) const;
+
+    std::vector<Entry> m_gateways;
+    unsigned int m_threshold;
+    std::chrono::milliseconds m_interval;
+    mutable std::mutex m_mutex;
+}; // class GatewayPool
+
+} // namespace Iridium
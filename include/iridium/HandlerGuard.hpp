@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <boost/noncopyable.hpp>
+
+namespace Iridium {
+
+///
+/// Защита объекта от обработчиков, выполняемых после его уничтожения.
+///
+/// Отмена таймера не отзывает обработчик, который уже сработал и ожидает
+/// в очереди цикла ввода/вывода. Поэтому обработчик захватывает не
+/// указатель на объект, а слабую ссылку weak() и обращается к объекту
+/// только внутри run(). После close() (его вызывает и деструктор)
+/// обработчики ничего не делают; close() дожидается выполняющихся.
+///
+/// Экземпляр объявляется членом защищаемого класса, close() вызывается
+/// в начале деструктора класса.
+///
+class HandlerGuard: private boost::noncopyable
+{
+  private:
+    struct State
+    {
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool closed;
+      unsigned int running; ///< Выполняющиеся обработчики.
+
+      State(): closed(false), running(0) {}
+    };
+
+  public:
+    typedef std::weak_ptr<State> Weak;
+
+    HandlerGuard(): m_state(std::make_shared<State>()) {}
+    ~HandlerGuard() { close(); }
+
+    inline Weak weak() const { return m_state; }
+
+    ///
+    /// Запретить обработчики и дождаться выполняющихся.
+    ///
+    /// Не вызывается из обработчика того же объекта.
+    ///
+    inline void close()
+    {
+      std::unique_lock<std::mutex> lock(m_state->mutex);
+      m_state->closed = true;
+      m_state->cond.wait(lock, [this]() { return !m_state->running; });
+    }
+
+    ///
+    /// Выполнить обработчик, если объект еще существует.
+    ///
+    /// @return false, если объект закрыт или уничтожен.
+    ///
+    template <typename Function>
+    static bool run(const Weak& weak, Function function)
+    {
+      std::shared_ptr<State> state = weak.lock();
+      if (!state) return false;
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        (void)lock;
+        if (state->closed) return false;
+        state->running++;
+      }
+      struct Leave
+      {
+        State& state;
+        ~Leave()
+        {
+          {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            (void)lock;
+            state.running--;
+          }
+          state.cond.notify_all();
+        }
+      } leave{ *state };
+      function();
+      return true;
+    }
+
+  private:
+    std::shared_ptr<State> m_state;
+}; // class HandlerGuard
+
+} // namespace Iridium
@@ -44,6 +44,10 @@ class IEMtConfirmationMsg:
                               ///< 1-65535).
     };
 
+    static const int16_t MaxQueueLength = 50; ///< Capacity of the MT message
+                                              ///< queue of one IMEI on the
+                                              ///< Iridium Gateway.
+
     IEMtConfirmationMsg(): InformationElement(InformationElement::eMtConfirmationMsg) {}
 
     ContentLength unpack(const char* data, ContentLength size) override;
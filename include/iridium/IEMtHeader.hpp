@@ -29,6 +29,15 @@ struct MtMessageFlags {
    inline uint16_t get() const
    { return flushMtQueue + (sendRingAlert << 1) + (updateSsdLocation << 3) +
             (highPriority << 4) + (assignMtmsh << 5); }
+
+   inline void set(uint16_t value)
+   {
+     flushMtQueue = value & 1;
+     sendRingAlert = (value >> 1) & 1;
+     updateSsdLocation = (value >> 3) & 1;
+     highPriority = (value >> 4) & 1;
+     assignMtmsh = (value >> 5) & 1;
+   }
 };
 
 struct IEMtHeaderDto
@@ -1,28 +1,412 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "QueueStats.hpp"
 
-/// 
-/// Шаблонный класс очереди задач.
+///
+/// Хранилище заданий JobUnitQueue на основе списка, защищенного мутексом.
+///
+/// Емкость не ограничена, каждое задание размещается в отдельном узле.
+///
+template <class Job> class JobListStorage
+{
+  public:
+    template <class T> struct rebind { typedef JobListStorage<T> other; };
+
+    static const bool bounded = false; ///< push() всегда успешен.
+
+    template <class T> inline bool push(T&& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      jobs.push_back(std::forward<T>(job));
+      return true;
+    }
+
+    template <class... Args> inline bool emplace(Args&&... args)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      jobs.emplace_back(std::forward<Args>(args)...);
+      return true;
+    }
+
+    inline bool pop(Job& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      if (jobs.empty()) return false;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      return true;
+    }
+
+    template <class Container> inline size_t pop(Container& out, size_t max)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      size_t n = 0;
+      while ((n < max) && !jobs.empty())
+      {
+        out.push_back(std::move(jobs.front()));
+        jobs.pop_front();
+        n++;
+      }
+      return n;
+    }
+
+    template <class T> inline void push_front(T&& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      jobs.push_front(std::forward<T>(job));
+    }
+
+    inline size_t clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      size_t n = jobs.size();
+      jobs.clear();
+      return n;
+    }
+
+    inline size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      return jobs.size();
+    }
+
+  private:
+    std::list<Job> jobs; ///< Очередь заданий.
+    mutable std::mutex mutex; ///< Мутекс списка заданий.
+};
+
+///
+/// Ограниченное хранилище заданий JobUnitQueue без блокировок.
+///
+/// Кольцевой массив ячеек с порядковыми номерами (очередь Д. Вьюкова с
+/// несколькими производителями и потребителями): постановка и извлечение
+/// задания -- одна операция compare-and-swap над позицией записи или чтения,
+/// память под задания выделяется один раз при создании.
+///
+/// Возврат задания в начало очереди (push_front()) кольцевым массивом не
+/// поддерживается, такие задания хранятся в отдельном списке под мутексом и
+/// извлекаются в первую очередь. Пока список пуст, мутекс не захватывается.
+///
+/// При заполнении хранилища JobUnitQueue::put() блокирует производителя на
+/// переменной состояния до извлечения задания, а не опрашивает хранилище.
+///
+template <class Job> class JobRingStorage
+{
+  public:
+    template <class T> struct rebind { typedef JobRingStorage<T> other; };
+
+    static const bool bounded = true; ///< push() может не найти места.
+    static const size_t DefaultCapacity = 1024;
+
+    ///
+    /// @param [in] capacity Емкость, округляется вверх до степени двойки.
+    ///
+    explicit JobRingStorage(size_t capacity = DefaultCapacity):
+      mask(roundUp(capacity) - 1),
+      cells(new Cell[mask + 1]),
+      returned(0)
+    {
+      for (size_t i = 0; i <= mask; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      enqueuePos.store(0, std::memory_order_relaxed);
+      dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    ///
+    /// @return false, если хранилище заполнено; в этом случае задание не
+    ///         перемещается.
+    ///
+    template <class T> inline bool push(T&& job)
+    {
+      Cell* cell;
+      size_t pos = enqueuePos.load(std::memory_order_relaxed);
+      while (true)
+      {
+        cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0)
+        {
+          if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0) return false;
+        else pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+      cell->job = std::forward<T>(job);
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    template <class... Args> inline bool emplace(Args&&... args)
+    {
+      return push(Job(std::forward<Args>(args)...));
+    }
+
+    inline bool pop(Job& job)
+    {
+      if (returned.load(std::memory_order_acquire) && popReturned(job))
+        return true;
+      Cell* cell;
+      size_t pos = dequeuePos.load(std::memory_order_relaxed);
+      while (true)
+      {
+        cell = &cells[pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+        if (diff == 0)
+        {
+          if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0) return false;
+        else pos = dequeuePos.load(std::memory_order_relaxed);
+      }
+      job = std::move(cell->job);
+      cell->job = Job();
+      cell->sequence.store(pos + mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    template <class Container> inline size_t pop(Container& out, size_t max)
+    {
+      size_t n = 0;
+      Job job;
+      while ((n < max) && pop(job))
+      {
+        out.push_back(std::move(job));
+        n++;
+      }
+      return n;
+    }
+
+    template <class T> inline void push_front(T&& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      front.push_front(std::forward<T>(job));
+      returned.fetch_add(1, std::memory_order_release);
+    }
+
+    inline size_t clear()
+    {
+      size_t n = 0;
+      Job job;
+      while (pop(job)) n++;
+      return n;
+    }
+
+    ///
+    /// Количество заданий, приблизительное при одновременных изменениях.
+    ///
+    inline size_t size() const
+    {
+      size_t head = dequeuePos.load(std::memory_order_relaxed),
+             tail = enqueuePos.load(std::memory_order_relaxed);
+      return ((tail > head) ? tail - head : 0) +
+             returned.load(std::memory_order_relaxed);
+    }
+
+    inline size_t capacity() const { return mask + 1; }
+
+  private:
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      Job job;
+    };
+
+    static size_t roundUp(size_t n)
+    {
+      size_t r = 2;
+      while (r < n) r <<= 1;
+      return r;
+    }
+
+    inline bool popReturned(Job& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      if (front.empty()) return false;
+      job = std::move(front.front());
+      front.pop_front();
+      returned.fetch_sub(1, std::memory_order_release);
+      return true;
+    }
+
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    char pad0[64]; ///< Позиции записи и чтения -- в разных строках кэша.
+    std::atomic<size_t> enqueuePos;
+    char pad1[64];
+    std::atomic<size_t> dequeuePos;
+    char pad2[64];
+    std::atomic<size_t> returned; ///< Количество заданий в списке front.
+    std::deque<Job> front; ///< Задания, возвращенные в начало очереди.
+    std::mutex mutex; ///< Мутекс списка front.
+};
 
+template <class Job> const bool JobListStorage<Job>::bounded;
+template <class Job> const bool JobRingStorage<Job>::bounded;
+template <class Job> const size_t JobRingStorage<Job>::DefaultCapacity;
+
+///
+/// Задание с временем постановки в очередь, хранится в очереди со
+/// статистикой.
+///
+template <class Job> struct StampedJob
+{
+  Job job;
+  Iridium::QueueStats::Clock::time_point stamp;
+
+  StampedJob(): job() {}
+  template <class T, class = typename std::enable_if<
+    !std::is_same<typename std::decay<T>::type, StampedJob>::value
+  >::type> StampedJob(T&& j):
+    job(std::forward<T>(j)), stamp(Iridium::QueueStats::Clock::now())
+  {}
+};
+
+///
+/// Пустая статистика очереди без счетчиков.
+///
+struct NullQueueStats
+{
+  inline void onEnqueue() {}
+  inline void onDequeue(Iridium::QueueStats::Clock::duration) {}
+  inline void onRemove(size_t) {}
+  inline Iridium::QueueStats::Snapshot snapshot() const
+  {
+    return Iridium::QueueStats::Snapshot();
+  }
+};
+
+///
+/// Шаблонный класс очереди задач.
+///
+/// Способ хранения заданий задается параметром Storage: JobListStorage
+/// (по умолчанию) -- неограниченный список под мутексом, JobRingStorage --
+/// ограниченный кольцевой массив без блокировок для случая многих
+/// производителей. Аргументы конструктора очереди передаются конструктору
+/// хранилища.
+///
+/// Задания перемещаются в очередь и из очереди без копирования, если Job
+/// это допускает. Потребитель может ожидать задание и извлекать его одним
+/// вызовом (pop_wait_for()), а также извлекать задания пакетами (drain()).
+/// Методы постановки в очередь сами уведомляют ожидающих потребителей.
+///
+/// Если параметр Instrumented равен true, очередь ведет статистику
+/// Iridium::QueueStats (глубина, количество операций, гистограмма времени
+/// ожидания), для чего вместе с заданием хранится время его постановки в
+/// очередь. Без статистики накладных расходов нет.
+///
 /// @author golovin
 ///
-template <class Job> class JobUnitQueue
+template <class Job, class Storage = JobListStorage<Job>,
+          bool Instrumented = false> class JobUnitQueue
 {
   public:
+    template <class... Args> explicit JobUnitQueue(Args&&... args):
+      jobs(std::forward<Args>(args)...)
+    {}
+
     ///
     /// Поместить очередное задание в очередь.
     ///
     /// @param [in] job Помещаемое задание
     ///
+    /// Если хранилище ограничено и заполнено, поток блокируется до
+    /// извлечения задания потребителем.
+    ///
     inline void put(const Job& job)
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      (void)lock;
-      jobs.push_back(job);
+      store(job, Tag());
+      wake();
+    }
+    inline void put(Job&& job)
+    {
+      store(std::move(job), Tag());
+      wake();
+    }
+
+    ///
+    /// Создать задание непосредственно в очереди.
+    ///
+    /// @param [in] args Аргументы конструктора задания.
+    ///
+    template <class... Args> inline void emplace(Args&&... args)
+    {
+      construct(Tag(), std::forward<Args>(args)...);
+      wake();
+    }
+
+    ///
+    /// Извлечь задание, если очередь не пуста.
+    ///
+    /// @param [out] job Задание.
+    /// @return false, если очередь пуста.
+    ///
+    inline bool try_pop(Job& job)
+    {
+      return take(job, Tag());
+    }
+
+    ///
+    /// Ожидать задание с таймаутом и извлечь его.
+    ///
+    /// @param [out] job Задание.
+    /// @param [in] timeout Таймаут.
+    /// @return false, если время ожидания истекло.
+    ///
+    /// В отличие от пары wait_for() и get(), задание, появление которого
+    /// дождался поток, не может быть извлечено другим потоком в промежутке
+    /// между вызовами.
+    ///
+    inline bool pop_wait_for(Job& job, std::chrono::milliseconds const& timeout)
+    {
+      if (take(job, Tag())) return true;
+      std::unique_lock<std::mutex> lock(mutex);
+      waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool ok = cond.wait_for(lock, timeout, [this, &job]() {
+        return take(job, Tag());
+      });
+      waiters.fetch_sub(1);
+      return ok;
+    }
+
+    ///
+    /// Извлечь несколько заданий.
+    ///
+    /// @param [out] out Контейнер, в конец которого дописываются задания.
+    /// @param [in] max Наибольшее количество заданий.
+    /// @return Количество извлеченных заданий.
+    ///
+    /// Хранилище на основе списка извлекает пакет за один захват мутекса.
+    ///
+    template <class Container> inline size_t drain(Container& out, size_t max)
+    {
+      return takeMany(out, max, Tag());
     }
 
     ///
@@ -32,17 +416,11 @@ template <class Job> class JobUnitQueue
     ///
     /// Если в очереди заданий нет, возвращает "пустое" задание,
     /// созданное конструктором по умолчанию класса Job.
-    /// 
+    ///
     inline Job get()
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      (void)lock;
-      Job job;
-      if (!jobs.empty())
-      {
-        job = jobs.front();
-        jobs.pop_front();
-      }
+      Job job = Job();
+      take(job, Tag());
       return job;
     }
 
@@ -51,11 +429,12 @@ template <class Job> class JobUnitQueue
     ///
     /// @param [in] job Возвращаемое задание
     ///
+    /// Время ожидания возвращенного задания отсчитывается заново.
+    ///
     inline void unget(const Job& job)
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      (void)lock;
-      jobs.push_front(job);
+      jobs.push_front(Item(job));
+      if (Instrumented) stats.onEnqueue();
     }
 
     ///
@@ -67,18 +446,28 @@ template <class Job> class JobUnitQueue
     inline bool wait_for(std::chrono::milliseconds const& abs_time)
     {
       std::unique_lock<std::mutex> lock(mutex);
-      if (!jobs.empty()) return false;
-      return (cond.wait_for(lock, abs_time) == std::cv_status::timeout);
+      waiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool timeout = !jobs.size() &&
+        (cond.wait_for(lock, abs_time) == std::cv_status::timeout);
+      waiters.fetch_sub(1);
+      return timeout;
     }
 
     ///
     /// Отправить уведомление о появлении задания в очереди.
     ///
-    /// Уведомление следует делать явно. При добавлении задания в очередь
-    /// методом put() этот метод не вызывается.
+    /// Методы постановки в очередь уведомляют ожидающих сами, явный вызов
+    /// нужен только после unget().
     ///
     inline void notify_one()
     {
+      // захват мутекса исключает потерю уведомления между проверкой
+      // очереди и началом ожидания в wait_for()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        (void)lock;
+      }
       cond.notify_one();
     }
 
@@ -87,21 +476,153 @@ template <class Job> class JobUnitQueue
     ///
     inline void clear()
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      (void)lock;
-      jobs.clear();
+      size_t n = jobs.clear();
+      if (n) freed();
+      if (Instrumented) stats.onRemove(n);
     }
 
     inline size_t size() const
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      (void)lock;
       return jobs.size();
     }
 
+    ///
+    /// Снимок статистики очереди.
+    ///
+    /// Без статистики (Instrumented равен false) возвращает нулевой снимок.
+    ///
+    inline Iridium::QueueStats::Snapshot statistics() const
+    {
+      return stats.snapshot();
+    }
+
   private:
-    std::list<Job> jobs; ///< Очередь заданий.
-    mutable std::mutex mutex; ///< Мутекс списка заданий и переменной состояния.
+    typedef std::integral_constant<bool, Instrumented> Tag;
+    typedef typename std::conditional<Instrumented, StampedJob<Job>, Job>::type Item;
+    typedef typename Storage::template rebind<Item>::other Store;
+
+    template <class T> inline void store(T&& job, std::false_type)
+    {
+      // хранилище перемещает задание только при успешной постановке
+      if (!jobs.push(std::forward<T>(job)))
+        waitSpace([this, &job]() { return jobs.push(std::forward<T>(job)); });
+    }
+    template <class T> inline void store(T&& job, std::true_type)
+    {
+      Item item(std::forward<T>(job));
+      if (!jobs.push(std::move(item)))
+        waitSpace([this, &item]() { return jobs.push(std::move(item)); });
+      stats.onEnqueue();
+    }
+
+    template <class... Args> inline void construct(std::false_type,
+                                                   Args&&... args)
+    {
+      // кольцевое хранилище создает задание до постановки, и при нехватке
+      // места аргументы были бы уже перемещены
+      if (Store::bounded)
+        store(Job(std::forward<Args>(args)...), Tag());
+        else jobs.emplace(std::forward<Args>(args)...);
+    }
+    template <class... Args> inline void construct(std::true_type,
+                                                   Args&&... args)
+    {
+      store(Job(std::forward<Args>(args)...), Tag());
+    }
+
+    inline bool take(Job& job, std::false_type)
+    {
+      if (!jobs.pop(job)) return false;
+      freed();
+      return true;
+    }
+    inline bool take(Job& job, std::true_type)
+    {
+      Item item;
+      if (!jobs.pop(item)) return false;
+      freed();
+      job = std::move(item.job);
+      stats.onDequeue(Iridium::QueueStats::Clock::now() - item.stamp);
+      return true;
+    }
+
+    template <class Container> inline size_t takeMany(Container& out,
+                                                      size_t max,
+                                                      std::false_type)
+    {
+      size_t n = jobs.pop(out, max);
+      if (n) freed();
+      return n;
+    }
+    template <class Container> inline size_t takeMany(Container& out,
+                                                      size_t max,
+                                                      std::true_type)
+    {
+      std::vector<Item> items;
+      size_t n = jobs.pop(items, max);
+      if (n) freed();
+      Iridium::QueueStats::Clock::time_point now =
+        Iridium::QueueStats::Clock::now();
+      for (auto& item: items)
+      {
+        out.push_back(std::move(item.job));
+        stats.onDequeue(now - item.stamp);
+      }
+      return n;
+    }
+
+    ///
+    /// Уведомить потребителя, если кто-то ожидает.
+    ///
+    inline void wake()
+    {
+      // барьер упорядочивает запись задания и проверку ожидающих
+      // относительно парной последовательности в pop_wait_for()
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed)) notify_one();
+    }
+
+    ///
+    /// Ожидать места в заполненном хранилище.
+    ///
+    /// @param [in] push Попытка постановки, выполняется под мутексом места.
+    ///
+    template <class Push> inline void waitSpace(Push push)
+    {
+      std::unique_lock<std::mutex> lock(spaceMutex);
+      spaceWaiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      spaceCond.wait(lock, push);
+      spaceWaiters.fetch_sub(1);
+    }
+
+    ///
+    /// Уведомить производителей, ожидающих места, если они есть.
+    ///
+    inline void freed()
+    {
+      if (!Store::bounded) return;
+      // парная последовательность в waitSpace() исключает потерю
+      // уведомления
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!spaceWaiters.load(std::memory_order_relaxed)) return;
+      {
+        std::lock_guard<std::mutex> lock(spaceMutex);
+        (void)lock;
+      }
+      spaceCond.notify_all();
+    }
+
+    Store jobs; ///< Хранилище заданий.
+    typename std::conditional<Instrumented, Iridium::QueueStats,
+                              NullQueueStats>::type stats;
+    std::atomic<unsigned int> waiters{0}; ///< Потоки, ожидающие задание.
+    std::mutex mutex; ///< Мутекс переменной состояния.
     std::condition_variable cond; ///< Переменная состояния для сигнала о
                                   ///< появлении нового задания.
+    std::atomic<unsigned int> spaceWaiters{0}; ///< Производители, ожидающие
+                                               ///< места.
+    std::mutex spaceMutex; ///< Мутекс ожидания места; отдельный, так как
+                           ///< задание извлекается и под мутексом mutex.
+    std::condition_variable spaceCond; ///< Сигнал об извлечении задания.
 };
@@ -4,6 +4,7 @@
 #include <ostream>
 #include <string>
 #include <vector>
+#include "IEMtHeader.hpp"
 #include "InformationElement.hpp"
 
 namespace Iridium {
@@ -56,6 +57,8 @@ class MoMessage: public Message
                                           ///< over Direct IP.
 
     MoMessage();
+    MoMessage(const MoMessage& other);
+    MoMessage& operator=(const MoMessage& other);
 
     std::string imei() const override;
     std::vector<char> payload() const override;
@@ -80,10 +83,24 @@ class MtMessage: public Message
                                           ///< over Direct IP.
 
     MtMessage();
+    MtMessage(const MtMessage& other);
+    MtMessage& operator=(const MtMessage& other);
 
     std::string imei() const override;
     std::vector<char> payload() const override;
     std::vector<char> serialize() override;
+    ///
+    /// Unique client message ID from MT header.
+    ///
+    uint32_t messageId() const;
+    ///
+    /// Message priority, 1-5 (5 is default and lowest).
+    ///
+    uint16_t priority() const;
+    ///
+    /// Message disposition flags.
+    ///
+    MtMessageFlags flags() const;
 
   private:
     std::vector<Message::Pointer>::iterator m_header,
@@ -99,6 +116,8 @@ class MtConfirmMessage
 
   public:
     MtConfirmMessage();
+    MtConfirmMessage(const MtConfirmMessage& other);
+    MtConfirmMessage& operator=(const MtConfirmMessage& other);
 
     std::string imei() const;
     uint32_t messageId() const;
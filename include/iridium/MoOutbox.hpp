@@ -0,0 +1,223 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include "Modem.hpp"
+
+namespace Iridium {
+
+///
+/// Очередь исходящих MO-сообщений модема с автоматическим повтором сеансов.
+///
+/// Сообщения, помещенные в очередь методом post(), передаются по одному
+/// транзакцией Modem::async_exchange() (запись, сеанс AT+SBDIX, прием
+/// MT-сообщений) через открытый модем; порт не переоткрывается между
+/// попытками. MT-сообщения, принятые попутно, передаются обработчику,
+/// назначенному setMtCallback().
+///
+/// Сеанс начинается, только если сеть доступна и уровень сигнала не ниже
+/// заданного (см. setMinSignal()). Используются индикаторы модема
+/// (Modem::EnableIndicatorEvents()), а если они неизвестны -- уровень
+/// сигнала запрашивается командой AT+CSQ. Пока условия не выполнены,
+/// проверка повторяется с периодом setPollInterval().
+///
+/// При неудачном сеансе (MO status 5 и выше) или ошибке модема попытка
+/// повторяется по рекомендации Iridium: несколько быстрых повторов, затем
+/// экспоненциально растущая пауза со случайным разбросом, чтобы устройства
+/// не повторяли сеансы синхронно (см. setQuickRetries() и setBackoff()).
+/// Статусы "try later" (36, 38) выдерживают паузу не менее 3 минут, запрет
+/// доступа и блокировка модема (15, 16) -- наибольшую паузу.
+///
+/// Доставка подтверждается по MOMSN: перед каждой попыткой MOMSN следующего
+/// сеанса запрашивается командой AT+SBDSX. Если итог сеанса неизвестен
+/// (таймаут, ответ не распознан), а MOMSN к следующей попытке изменился,
+/// сообщение считается доставленным и не передается повторно.
+///
+/// Очередь должна быть единственным отправителем MO-сообщений модема.
+/// Обработчики вызываются во внешнем цикле ввода/вывода модема; экземпляр
+/// должен существовать, пока цикл не обработал все его операции (после
+/// stop() и закрытия модема).
+///
+class MoOutbox: private boost::noncopyable
+{
+  public:
+    ///
+    /// Итог доставки MO-сообщения.
+    ///
+    struct Delivery
+    {
+      uint64_t id; ///< Номер сообщения, выданный post().
+      uint16_t momsn; ///< MOMSN, с которым сообщение передано.
+      unsigned int attempts; ///< Количество попыток.
+      bool inferred; ///< Итог сеанса неизвестен, доставка установлена по
+                     ///< изменению MOMSN.
+
+      Delivery(): id(0), momsn(0), attempts(0), inferred(false) {}
+    };
+
+    typedef std::function<void (const Delivery&)> DeliveryCallback;
+    typedef std::function<void (const std::vector<char>&)> MtCallback;
+
+    static const unsigned int DefaultQuickRetries;
+    static const std::chrono::milliseconds DefaultQuickDelay;
+    static const std::chrono::milliseconds DefaultMinDelay;
+    static const std::chrono::milliseconds DefaultMaxDelay;
+    static const std::chrono::milliseconds DefaultPollInterval;
+    static const std::chrono::milliseconds TryLaterDelay;
+
+    ///
+    /// @param [in] service Внешний цикл ввода/вывода, переданный
+    ///                     конструктору модема.
+    /// @param [in] modem Модем; открывается и закрывается вызывающей
+    ///                   стороной.
+    ///
+    MoOutbox(boost::asio::io_service& service, Modem& modem);
+
+    ///
+    /// Назначить обработчик доставки сообщения. Назначать следует до
+    /// start().
+    ///
+    inline void setDeliveryCallback(const DeliveryCallback& callback)
+    {
+      m_deliveryCallback = callback;
+    }
+    ///
+    /// Назначить обработчик MT-сообщений, принятых сеансами очереди.
+    /// Назначать следует до start().
+    ///
+    inline void setMtCallback(const MtCallback& callback)
+    {
+      m_mtCallback = callback;
+    }
+    ///
+    /// Задать быстрые повторы после неудачной попытки.
+    ///
+    /// @param [in] count Количество быстрых повторов.
+    /// @param [in] delay Пауза перед быстрым повтором.
+    ///
+    void setQuickRetries(unsigned int count,
+                         std::chrono::milliseconds const& delay);
+    ///
+    /// Задать пределы паузы после быстрых повторов.
+    ///
+    /// @param [in] min Начальная пауза.
+    /// @param [in] max Наибольшая пауза.
+    ///
+    /// Пауза удваивается при каждой очередной неудаче и сбрасывается при
+    /// доставке сообщения; к ней добавляется случайная величина до четверти
+    /// паузы.
+    ///
+    void setBackoff(std::chrono::milliseconds const& min,
+                    std::chrono::milliseconds const& max);
+    ///
+    /// Задать наименьший уровень сигнала для начала сеанса, 0-5.
+    ///
+    inline void setMinSignal(uint8_t quality) { m_minSignal = quality; }
+    ///
+    /// Задать период проверки сети и сигнала, пока сеанс невозможен.
+    ///
+    inline void setPollInterval(std::chrono::milliseconds const& interval)
+    {
+      m_pollInterval = interval;
+    }
+
+    ///
+    /// Начать передачу сообщений очереди.
+    ///
+    /// Метод потокобезопасен, запуск выполняется во внешнем цикле
+    /// ввода/вывода.
+    ///
+    void start();
+    ///
+    /// Остановить передачу. Выполняемая попытка завершается, сообщения
+    /// остаются в очереди.
+    ///
+    /// Метод потокобезопасен, остановка выполняется во внешнем цикле
+    /// ввода/вывода.
+    ///
+    void stop();
+
+    ///
+    /// Поместить сообщение в очередь.
+    ///
+    /// @param [in] payload Сообщение.
+    /// @return Номер сообщения, не равен нулю.
+    /// @throw std::runtime_error Недопустимая длина сообщения.
+    ///
+    /// Метод потокобезопасен.
+    ///
+    uint64_t post(const std::vector<char>& payload);
+    ///
+    /// Количество сообщений в очереди, включая передаваемое.
+    ///
+    size_t size() const;
+
+  private:
+    ///
+    /// Сообщение в очереди.
+    ///
+    struct Entry
+    {
+      uint64_t id;
+      std::vector<char> payload;
+      unsigned int attempts; ///< Выполненные попытки.
+    };
+
+    ///
+    /// Начать попытку, если очередь не пуста и нет паузы.
+    ///
+    void kick();
+    void onSbdStatus(const boost::system::error_code& ec,
+                     const Modem::SbdStatus& status);
+    void onSignal(const boost::system::error_code& ec, uint8_t quality);
+    void exchange();
+    void onExchange(const boost::system::error_code& ec,
+                    const Modem::ExchangeResult& result);
+    ///
+    /// Удалить переданное сообщение из очереди и сообщить о доставке.
+    ///
+    void delivered(uint16_t momsn, bool inferred);
+    ///
+    /// Отложить повтор после неудачной попытки.
+    ///
+    /// @param [in] moStatus MO status сеанса; 0 -- сеанс не выполнен.
+    ///
+    void retry(uint8_t moStatus);
+    ///
+    /// Выдержать паузу и начать попытку.
+    ///
+    void wait(std::chrono::milliseconds const& delay);
+
+    boost::asio::io_service& m_service;
+    Modem& m_modem;
+    boost::asio::steady_timer m_timer;
+    DeliveryCallback m_deliveryCallback;
+    MtCallback m_mtCallback;
+    unsigned int m_quickRetries;
+    std::chrono::milliseconds m_quickDelay;
+    std::chrono::milliseconds m_minDelay, m_maxDelay;
+    std::chrono::milliseconds m_pollInterval;
+    uint8_t m_minSignal;
+    std::minstd_rand m_random; ///< Разброс паузы повтора.
+    // состояние очереди, изменяется во внешнем цикле ввода/вывода
+    bool m_running;
+    bool m_active; ///< Выполняется попытка.
+    bool m_waiting; ///< Выдерживается пауза.
+    unsigned int m_failures; ///< Неудачи подряд.
+    uint16_t m_expectedMomsn; ///< MOMSN передаваемого сообщения.
+    bool m_checkDelivery; ///< Итог последней попытки неизвестен.
+    // очередь, защищена m_mutex
+    std::deque<Entry> m_queue;
+    uint64_t m_nextId;
+    mutable std::mutex m_mutex;
+}; // class MoOutbox
+
+} // namespace Iridium
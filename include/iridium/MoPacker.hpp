@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include "HandlerGuard.hpp"
+#include "MoOutbox.hpp"
+
+namespace Iridium {
+
+///
+/// Упаковка записей приложения в MO-сообщения перед отправкой модемом.
+///
+/// Записи, поступившие в течение времени удержания, упаковываются (см.
+/// PayloadFraming) в одно MO-сообщение и передаются в очередь MoOutbox.
+/// Так мелкие записи не тратят по сеансу SBD каждая: накладные расходы
+/// сеанса и округление при тарификации приходятся на весь пакет.
+///
+/// Время удержания отсчитывается от первой записи в пакете. Пакет
+/// отправляется досрочно, если очередная запись в него не помещается или
+/// свободного места не осталось. Наибольшая длина пакета зависит от модема:
+/// 340 байт для 9602/9603, до IEMoPayload::MaxPayloadLength для остальных.
+/// Нулевое время удержания отключает объединение: каждая запись
+/// отправляется сразу, но тоже в упакованном виде.
+///
+/// На сервере нагрузка разбирается функцией PayloadFraming::split().
+///
+/// Таймер удержания работает в цикле ввода/вывода очереди. Экземпляр
+/// должен быть уничтожен раньше очереди, при уничтожении удерживаемый пакет
+/// отправляется. Уничтожать экземпляр можно в любом потоке: таймер,
+/// сработавший к этому моменту, к нему уже не обращается.
+///
+class MoPacker: private boost::noncopyable
+{
+  public:
+    static const size_t DefaultPayloadLimit; ///< 340 байт, 9602/9603.
+    static const std::chrono::milliseconds DefaultHoldTime;
+
+    ///
+    /// @param [in] service Цикл ввода/вывода таймера удержания.
+    /// @param [in] outbox Очередь MO-сообщений.
+    /// @param [in] limit Наибольшая длина MO-сообщения.
+    /// @param [in] holdTime Время удержания.
+    /// @throw std::runtime_error Длина не больше префикса записи или больше
+    ///                           IEMoPayload::MaxPayloadLength.
+    ///
+    MoPacker(boost::asio::io_service& service, MoOutbox& outbox,
+             size_t limit = DefaultPayloadLimit,
+             std::chrono::milliseconds const& holdTime = DefaultHoldTime);
+    ~MoPacker();
+
+    inline size_t limit() const { return m_limit; }
+    ///
+    /// Изменить время удержания.
+    ///
+    /// Действует для пакетов, создаваемых после вызова.
+    ///
+    void setHoldTime(std::chrono::milliseconds const& holdTime);
+
+    ///
+    /// Поместить запись в пакет.
+    ///
+    /// @param [in] data Запись приложения.
+    /// @param [in] size Длина записи.
+    /// @throw std::runtime_error Упакованная запись длиннее предела.
+    ///
+    /// О доставке пакетов сообщает обработчик MoOutbox::setDeliveryCallback().
+    ///
+    void post(const char* data, size_t size);
+    ///
+    /// Отправить удерживаемый пакет.
+    ///
+    void flush();
+
+    ///
+    /// Количество записей в удерживаемом пакете.
+    ///
+    size_t pending() const;
+
+  private:
+    ///
+    /// Отправить пакет в очередь.
+    ///
+    /// Вызывается без захваченного мутекса.
+    ///
+    void send(std::vector<char>& payload);
+
+    boost::asio::io_service& m_service;
+    MoOutbox& m_outbox;
+    size_t m_limit;
+    std::chrono::milliseconds m_holdTime;
+    std::vector<char> m_payload; ///< Упакованные записи.
+    size_t m_records; ///< Количество записей в пакете.
+    std::shared_ptr<boost::asio::steady_timer> m_timer; ///< Таймер удержания
+                                                         ///< пакета.
+    mutable std::mutex m_mutex;
+    HandlerGuard m_guard; ///< Обработчики таймера удержания.
+}; // class MoPacker
+
+} // namespace Iridium
@@ -1,18 +1,85 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <stdint.h>
 #include <boost/asio.hpp>
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include "AtResponse.hpp"
 
 namespace Iridium {
 
+class ModemReactor;
+
+///
+/// Модем Iridium, подключенный к последовательному порту.
+///
+/// Команды модему выполняются по одной в порядке поступления в отдельном
+/// потоке ввода/вывода, который работает, пока порт открыт. Для каждой
+/// команды есть синхронный метод (NetGetStatus(), DoSbdSession() и т.п.),
+/// блокирующий вызывающий поток до ответа модема, и асинхронный
+/// (async_net_get_status(), async_do_sbd_session() и т.п.), принимающий
+/// маркер завершения boost::asio: функцию-обработчик, boost::asio::use_future
+/// и т.д. Обработчики асинхронных методов вызываются через связанный с ними
+/// исполнитель (например, boost::asio::bind_executor()), по умолчанию -- во
+/// внешнем цикле ввода/вывода, переданном конструктору; исполнитель не
+/// завершает работу, пока обработчик не вызван. Первый аргумент
+/// обработчика -- код ошибки:
+/// - boost::asio::error::timed_out -- модем не ответил за отведенное время;
+/// - boost::asio::error::operation_aborted -- операция отменена cancel() или
+///   Close();
+/// - boost::asio::error::not_connected -- порт не открыт;
+/// - boost::system::errc::protocol_error -- модем ответил ERROR;
+/// - boost::system::errc::bad_message -- ответ модема не распознан.
+///
+/// Пока команды не выполняются, поток ввода/вывода читает незапрошенные
+/// сообщения модема (unsolicited result codes): SBDRING -- вызов на прием
+/// MT-сообщения, разрешается SbdEnableRingAlert(); +CIEV -- изменение
+/// индикаторов уровня сигнала, доступности сети и неисправности антенны,
+/// разрешается EnableIndicatorEvents(). Такие сообщения, пришедшие вперемешку
+/// с ответом на команду, также распознаются и из ответа удаляются. О них
+/// сообщают обработчики, назначенные setRingCallback() и
+/// setIndicatorCallback(), последние значения индикаторов доступны через
+/// signalQuality() и serviceAvailable(). Так прием MT-сообщений можно
+/// выполнять сеансом AT+SBDIXA по вызову, а не периодическим опросом.
+///
+/// Модем, созданный с общим реактором ModemReactor, не запускает своего
+/// потока: обмен с портом ведется в потоке реактора вместе с портами других
+/// модемов.
+///
 class Modem: private boost::noncopyable
 {
   public:
+    ///
+    /// Индикаторы модема, сообщаемые +CIEV.
+    ///
+    enum EIndicator: uint8_t
+    {
+      eSignalIndicator = 0, ///< Уровень сигнала, 0-5.
+      eServiceIndicator = 1, ///< Доступность сети, 0 или 1.
+      eAntennaIndicator = 2 ///< Неисправность антенны, 0 или 1.
+    };
+
+    ///
+    /// Обработчик вызова SBDRING.
+    ///
+    typedef std::function<void ()> RingCallback;
+    ///
+    /// Обработчик изменения индикатора: индикатор и его новое значение.
+    ///
+    typedef std::function<void (EIndicator, uint8_t)> IndicatorCallback;
+
     enum EClearMessageBuffers: uint8_t
     {
       eClearMObuffer = 0,
@@ -57,9 +124,60 @@ class Modem: private boost::noncopyable
                                ///< will be zero.
       uint8_t mt_queue; ///< A count of mobile terminated SBD messages waiting
                         ///< at the GSS.
+
+      SbdSessionStatus():
+        mo_status(0), momsn(0), mt_status(0), mtmsn(0), mt_message_len(0),
+        mt_queue(0)
+      {}
+    };
+
+    ///
+    /// Состояние модема, полученное одной командной строкой.
+    ///
+    struct StatusSnapshot
+    {
+      uint8_t net_status; ///< Registration status, as NetGetStatus().
+      uint8_t signal_quality; ///< Last known signal quality, 0-5 (+CSQF).
+      SbdStatus sbd; ///< SBD status, as SbdGetStatus().
+
+      StatusSnapshot(): net_status(4), signal_quality(0) {}
+    };
+
+    ///
+    /// Результат транзакции Exchange().
+    ///
+    struct ExchangeResult
+    {
+      uint8_t write_status; ///< Result of writing MO message, as
+                            ///< WriteMessage(); 0 if there was no message.
+      bool mo_written; ///< MO message was written to the modem buffer, so a
+                       ///< session may have sent it; false if the exchange
+                       ///< was aborted or failed before that.
+      SbdSessionStatus session; ///< Status of the first session, including
+                                ///< MO message disposition.
+      uint8_t sessions; ///< Number of SBD sessions performed.
+      uint8_t mt_queue; ///< MT messages still queued at the GSS after the
+                        ///< last session.
+      std::vector<std::vector<char> > mt; ///< Received MT messages, in order.
+
+      ExchangeResult():
+        write_status(0), mo_written(false), sessions(0), mt_queue(0)
+      {}
     };
 
+    ///
+    /// Наибольшее количество сеансов одной транзакции Exchange(): первый и
+    /// по одному на каждое MT-сообщение очереди шлюза (до 50).
+    ///
+    static const uint8_t MaxExchangeSessions = 51;
+
     Modem(boost::asio::io_service& service, const std::string& device);
+    ///
+    /// @param [in] reactor Общий цикл ввода/вывода портов; должен
+    ///                     существовать дольше модема.
+    ///
+    Modem(boost::asio::io_service& service, const std::string& device,
+          ModemReactor& reactor);
     ~Modem();
 
     inline bool isOpen() const { return m_io.is_open(); }
@@ -74,10 +192,56 @@ class Modem: private boost::noncopyable
     bool GetSignalQuality(uint8_t& quality, bool lastKnown = false);
     bool SbdDetach(uint8_t& error);
     bool SbdGetStatus(SbdStatus& status);
+    ///
+    /// Получить регистрацию в сети, уровень сигнала и состояние SBD за один
+    /// обмен с модемом (AT+CREG?;+CSQF;+SBDSX).
+    ///
+    /// Порт занят втрое меньше, чем при трех отдельных командах.
+    ///
+    bool GetStatusSnapshot(StatusSnapshot& snapshot);
     bool SbdClearBuffers(EClearMessageBuffers clear);
     bool ClearMomsn();
     bool GetImei(std::string& imei);
     ///
+    /// Разрешить или запретить сообщения SBDRING (AT+SBDMTA).
+    ///
+    bool SbdEnableRingAlert(bool enable);
+    ///
+    /// Разрешить сообщения +CIEV для выбранных индикаторов (AT+CIER).
+    ///
+    /// Модем сразу сообщает текущие значения разрешенных индикаторов.
+    ///
+    bool EnableIndicatorEvents(bool signal, bool service, bool antenna);
+    ///
+    /// Назначить обработчик вызова SBDRING.
+    ///
+    /// Обработчик вызывается во внешнем цикле ввода/вывода. Назначать
+    /// следует до Open().
+    ///
+    inline void setRingCallback(const RingCallback& callback)
+    {
+      m_ringCallback = callback;
+    }
+    ///
+    /// Назначить обработчик изменения индикатора.
+    ///
+    /// Обработчик вызывается во внешнем цикле ввода/вывода. Назначать
+    /// следует до Open().
+    ///
+    inline void setIndicatorCallback(const IndicatorCallback& callback)
+    {
+      m_indicatorCallback = callback;
+    }
+    ///
+    /// Последний сообщенный уровень сигнала, 0-5; -1, если неизвестен.
+    ///
+    inline int signalQuality() const { return m_signalQuality.load(); }
+    ///
+    /// Последнее сообщенное состояние сети: 1 -- доступна, 0 -- нет, -1 --
+    /// неизвестно.
+    ///
+    inline int serviceAvailable() const { return m_serviceAvailable.load(); }
+    ///
     /// Write MO message to modem buffer.
     ///
     /// @param [in] payload Payload buffer.
@@ -109,44 +273,507 @@ class Modem: private boost::noncopyable
     /// @throw std::runtime_error
     ///
     SbdSessionStatus DoSbdSession(bool answer);
+    ///
+    /// Обмен SBD одной операцией: запись MO-сообщения, сеанс AT+SBDIX, чтение
+    /// принятого MT-сообщения и повторные сеансы, пока на шлюзе есть
+    /// MT-сообщения (mt_queue > 0).
+    ///
+    /// Шаги выполняются подряд, без возврата в очередь команд, так что другие
+    /// команды не вклиниваются между ними. Переданное MO-сообщение удаляется
+    /// из буфера модема, чтобы повторные сеансы его не отправили, в том числе
+    /// когда не удалось прочитать принятое MT-сообщение; не переданное --
+    /// остается, повторные сеансы не выполняются.
+    ///
+    /// @param [in] payload MO-сообщение; пустое -- только проверка
+    ///                     почтового ящика (буфер MO очищается).
+    /// @throw std::runtime_error Запись сообщения или первый сеанс не удались.
+    ///
+    /// Ошибка в последующих сеансах прекращает прием очереди, но результат
+    /// возвращается: принятые сообщения уже удалены из буфера модема.
+    ///
+    ExchangeResult Exchange(const std::vector<char>& payload);
+
+    ///
+    /// Асинхронный запрос состояния регистрации в сети (AT+CREG?).
+    ///
+    /// Сигнатура обработчика: void (boost::system::error_code, uint8_t).
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code, uint8_t))
+    async_net_get_status(CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, uint8_t)> init(token);
+      startNetGetStatus(deliver<uint8_t>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронный запрос уровня сигнала (AT+CSQ или AT+CSQF).
+    ///
+    /// Сигнатура обработчика: void (boost::system::error_code, uint8_t).
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code, uint8_t))
+    async_get_signal_quality(bool lastKnown, CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, uint8_t)> init(token);
+      startGetSignalQuality(lastKnown, deliver<uint8_t>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронный запрос состояния SBD (AT+SBDSX).
+    ///
+    /// Сигнатура обработчика: void (boost::system::error_code, SbdStatus).
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code, SbdStatus))
+    async_sbd_get_status(CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, SbdStatus)> init(token);
+      startSbdGetStatus(deliver<SbdStatus>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронный запрос состояния модема одной командной строкой.
+    ///
+    /// Сигнатура обработчика:
+    /// void (boost::system::error_code, StatusSnapshot).
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code,
+                                        StatusSnapshot))
+    async_get_status_snapshot(CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, StatusSnapshot)> init(token);
+      startStatusSnapshot(deliver<StatusSnapshot>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронная запись MO-сообщения в буфер модема.
+    ///
+    /// Сигнатура обработчика: void (boost::system::error_code, uint8_t),
+    /// второй аргумент -- код результата, как у WriteMessage(). При
+    /// недопустимой длине сообщения -- ошибка
+    /// boost::system::errc::invalid_argument.
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code, uint8_t))
+    async_write_message(const std::vector<char>& payload,
+                        CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, uint8_t)> init(token);
+      startWriteMessage(payload, deliver<uint8_t>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронное чтение MT-сообщения из буфера модема.
+    ///
+    /// Сигнатура обработчика:
+    /// void (boost::system::error_code, std::vector<char>), сообщение пусто,
+    /// если в буфере модема его нет.
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code,
+                                        std::vector<char>))
+    async_read_message(CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, std::vector<char>)> init(token);
+      startReadMessage(deliver<std::vector<char> >(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронный сеанс SBD (AT+SBDIX или AT+SBDIXA).
+    ///
+    /// Сигнатура обработчика:
+    /// void (boost::system::error_code, SbdSessionStatus).
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code,
+                                        SbdSessionStatus))
+    async_do_sbd_session(bool answer, CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, SbdSessionStatus)> init(token);
+      startSbdSession(answer, deliver<SbdSessionStatus>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Асинхронный обмен SBD, как Exchange().
+    ///
+    /// Сигнатура обработчика:
+    /// void (boost::system::error_code, ExchangeResult). Если модем отверг
+    /// MO-сообщение -- ошибка boost::system::errc::protocol_error и
+    /// ненулевой write_status.
+    ///
+    template <class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken,
+                                  void (boost::system::error_code,
+                                        ExchangeResult))
+    async_exchange(const std::vector<char>& payload, CompletionToken&& token)
+    {
+      boost::asio::async_completion<CompletionToken,
+        void (boost::system::error_code, ExchangeResult)> init(token);
+      startExchange(payload, deliver<ExchangeResult>(init.completion_handler));
+      return init.result.get();
+    }
+    ///
+    /// Отменить выполняемую и ожидающие операции.
+    ///
+    /// Обработчики отмененных операций вызываются с ошибкой
+    /// boost::asio::error::operation_aborted. Модем может продолжить уже
+    /// принятую им команду (например, сеанс SBD); ее ответ будет отброшен:
+    /// после операции, прерванной по таймауту или отменой, перед следующей
+    /// ввод из порта пропускается до итогового кода результата (OK или
+    /// ERROR) или до паузы ResyncQuietTime.
+    ///
+    void cancel();
 
   private:
+    Modem(boost::asio::io_service& service, const std::string& device,
+          ModemReactor* reactor);
+
+    static const uint16_t ResyncQuietTime = 3; ///< Пауза, после которой
+                                               ///< ответ прерванной команды
+                                               ///< больше не ожидается, с.
+
+    ///
+    /// Обработчик, учтенный в m_pending.
+    ///
+    template <class Handler>
+    struct Tracked
+    {
+      Modem* modem;
+      Handler handler;
+
+      template <class... Args> void operator()(Args&&... args)
+      {
+        handler(std::forward<Args>(args)...);
+        modem->release();
+      }
+    };
+
+    ///
+    /// Учесть обработчик, передаваемый циклу ввода/вывода порта.
+    ///
+    /// С общим реактором Close() ждет, пока учтенные обработчики не будут
+    /// вызваны: потока, который можно было бы дождаться, у модема нет.
+    ///
+    template <class Handler>
+    Tracked<Handler> track(Handler handler)
+    {
+      m_pending.fetch_add(1);
+      return Tracked<Handler>{ this, std::move(handler) };
+    }
+    void release();
+
+    ///
+    /// Внутренний обработчик завершения операции, вызывается в потоке
+    /// ввода/вывода модема.
+    ///
+    template <class Result> using Completion =
+      std::function<void (const boost::system::error_code&, const Result&)>;
+    ///
+    /// Операция в очереди команд.
+    ///
+    struct Operation
+    {
+      std::function<void ()> start; ///< Начать выполнение.
+      std::function<void (const boost::system::error_code&)>
+        abort; ///< Завершить, не начиная, с ошибкой.
+    };
+
+    ///
+    /// Обработчик пользователя и "сторож" его исполнителя.
+    ///
+    /// Обработчик может быть только перемещаемым, поэтому хранится в
+    /// разделяемом владении, а не копируется в Completion.
+    ///
+    template <class Handler>
+    struct HandlerHolder
+    {
+      typedef typename boost::asio::associated_executor<
+        Handler, boost::asio::io_service::executor_type
+      >::type Executor;
+
+      Handler handler;
+      boost::asio::executor_work_guard<Executor> work; ///< Исполнитель не
+                                                       ///< завершает работу
+                                                       ///< до вызова.
+
+      HandlerHolder(Handler&& h, const Executor& executor):
+        handler(std::move(h)), work(executor)
+      {}
+    };
+
+    ///
+    /// Вызов обработчика пользователя с итогом операции.
+    ///
+    /// Связанный с обработчиком распределитель памяти используется для
+    /// размещения вызова в очереди исполнителя.
+    ///
+    template <class Handler, class Result>
+    struct Invocation
+    {
+      typedef typename boost::asio::associated_allocator<Handler>::type
+        allocator_type;
+
+      std::shared_ptr<HandlerHolder<Handler> > holder;
+      boost::system::error_code ec;
+      Result result;
+
+      allocator_type get_allocator() const noexcept
+      {
+        return boost::asio::get_associated_allocator(holder->handler);
+      }
+
+      void operator()()
+      {
+        holder->handler(ec, std::move(result));
+        holder->work.reset();
+      }
+    };
+
+    ///
+    /// Обернуть обработчик пользователя: вызов через связанный с ним
+    /// исполнитель, по умолчанию -- во внешнем цикле ввода/вывода.
+    ///
+    template <class Result, class Handler>
+    Completion<Result> deliver(Handler& handler)
+    {
+      auto executor = boost::asio::get_associated_executor(
+        handler, m_service.get_executor()
+      );
+      auto holder = std::make_shared<HandlerHolder<Handler> >(
+        std::move(handler), executor
+      );
+      return [holder](const boost::system::error_code& ec,
+                      const Result& result) {
+        boost::asio::post(holder->work.get_executor(),
+                          Invocation<Handler, Result>{ holder, ec, result });
+      };
+    }
+
+    void startNetGetStatus(const Completion<uint8_t>& handler);
+    void startGetSignalQuality(bool lastKnown,
+                               const Completion<uint8_t>& handler);
+    void startSbdGetStatus(const Completion<SbdStatus>& handler);
+    void startStatusSnapshot(const Completion<StatusSnapshot>& handler);
+    void startWriteMessage(const std::vector<char>& payload,
+                           const Completion<uint8_t>& handler);
+    void startReadMessage(const Completion<std::vector<char> >& handler);
+    void startSbdSession(bool answer,
+                         const Completion<SbdSessionStatus>& handler);
+    void startExchange(const std::vector<char>& payload,
+                       const Completion<ExchangeResult>& handler);
+
+    struct ExchangeState;
+    ///
+    /// Сеанс транзакции Exchange() и чтение принятого MT-сообщения.
+    ///
+    void exchangeSession(const std::shared_ptr<ExchangeState>& state);
+    ///
+    /// Продолжить транзакцию Exchange() следующим сеансом или завершить.
+    ///
+    void exchangeNext(const std::shared_ptr<ExchangeState>& state);
+    void exchangeFinish(const std::shared_ptr<ExchangeState>& state,
+                        const boost::system::error_code& ec);
+    ///
+    /// Выполнить команду, ответ которой завершается кодом OK или ERROR.
+    ///
+    /// @param [in] command Команда, включая завершающий символ '\r'.
+    /// @param [in] timeout Таймаут ответа, с.
+    /// @param [in] handler Обработчик, получает ответ; ответ действителен
+    ///                     только во время вызова.
+    ///
+    void startCommand(const std::string& command, uint16_t timeout,
+                      const Completion<AtResponse>& handler);
+    ///
+    /// Шаги операций: выполняются в потоке ввода/вывода внутри уже начатой
+    /// операции, в очередь команд не ставятся.
+    ///
+    void commandStep(const std::shared_ptr<std::string>& command,
+                     uint16_t timeout, const Completion<AtResponse>& handler);
+    ///
+    /// Очистить буфер MO (AT+SBDD0); код результата, отличный от 0, --
+    /// ошибка boost::system::errc::protocol_error.
+    ///
+    void clearMoStep(const std::function<void (const boost::system::error_code&)>& handler);
+    void writeMessageStep(const std::shared_ptr<std::string>& command,
+                          const std::shared_ptr<std::string>& data,
+                          const Completion<uint8_t>& handler);
+    void readMessageStep(const Completion<std::vector<char> >& handler);
+    void sessionStep(bool answer, const Completion<SbdSessionStatus>& handler);
+    ///
+    /// Выполнить команду синхронно.
+    ///
+    /// @param [in] parse Разбор ответа, вызывается в потоке ввода/вывода;
+    ///                   false -- ответ не распознан.
+    ///
+    template <class Result>
+    boost::system::error_code execute(
+      const std::string& command, uint16_t timeout,
+      const std::function<bool (const AtResponse&, Result&)>& parse,
+      Result& result);
+    ///
+    /// Поставить операцию в очередь команд.
+    ///
+    /// Тело операции body вызывается в потоке ввода/вывода, когда
+    /// завершены предыдущие операции, и должно вызвать переданный ему
+    /// обработчик ровно один раз.
+    ///
+    template <class Result>
+    void submit(const Completion<Result>& handler,
+                const std::function<void (const Completion<Result>&)>& body);
+    ///
+    /// Начать следующую операцию из очереди.
+    ///
+    void nextOperation();
+    ///
+    /// Начать операцию, пропустив ответ прерванной.
+    ///
+    void startOperation(const std::function<void ()>& start);
+    ///
+    /// Пропустить ввод из порта до итогового кода результата или паузы
+    /// ResyncQuietTime, если ответ прерванной команды еще может прийти
+    /// (@m_dirty).
+    ///
+    /// Незапрошенные сообщения при этом обрабатываются. Обработчик
+    /// вызывается и при отмене или ошибке порта, флаг @m_dirty тогда
+    /// остается.
+    ///
+    void resyncStep(const std::function<void ()>& handler);
+    ///
+    /// Ждать незапрошенные сообщения, если модем свободен.
+    ///
+    void listen();
+    ///
+    /// Разобрать строки из буфера приема как незапрошенные сообщения и
+    /// очистить буфер.
+    ///
+    void drainUnsolicited();
+    ///
+    /// Удалить из ответа модема незапрошенные сообщения, обработав их.
+    ///
+    /// @return Новая длина ответа.
+    ///
+    size_t stripUnsolicited(char* data, size_t size);
+    ///
+    /// Обработать строку, если это незапрошенное сообщение.
+    ///
+    /// @return true, если строка -- незапрошенное сообщение.
+    ///
+    bool handleUnsolicited(const char* begin, const char* end);
+    ///
+    /// Записать данные в порт.
+    ///
+    void writeStep(const std::shared_ptr<std::string>& data, uint16_t timeout,
+                   const std::function<void (const boost::system::error_code&)>& handler);
+    ///
+    /// Дописать в буфер приема данные из порта.
+    ///
+    /// Перед чтением необработанные данные сдвигаются в начало буфера.
+    ///
+    void receive(const std::function<void (const boost::system::error_code&)>& handler);
+    ///
+    /// Читать из порта до ожидаемой строки или ERROR.
+    ///
+    /// @param [in] expected Ожидаемая строка; должна существовать до
+    ///                      завершения шага.
+    ///
+    void readUntilStep(const char* expected, uint16_t timeout,
+                       const Completion<AtResponse>& handler);
+    void readUntil(const char* expected, const Completion<AtResponse>& handler);
+    ///
+    /// Читать из порта заданное количество байт.
+    ///
+    void readStep(size_t size, uint16_t timeout,
+                  const Completion<AtResponse>& handler);
+    void read(size_t size, const Completion<AtResponse>& handler);
+    ///
+    /// Запустить таймер шага операции.
+    ///
+    void arm(uint16_t timeout);
+    ///
+    /// Остановить таймер шага операции.
+    ///
+    /// @return Код завершения шага; прерывание по таймеру заменяется на
+    ///         boost::asio::error::timed_out. Прерванный шаг помечает порт
+    ///         @m_dirty.
     ///
-    /// Читать данные из последовательного порта до обнаружения разделителя.
+    boost::system::error_code disarm(const boost::system::error_code& ec);
     ///
-    /// @param [out] buf Буфер полученных данных, включая разделитель.
-    /// @param [in] delim Разделитель данных.
-    /// @param [out] ec Код завершения операции.
-    /// @param [in] timeout Таймаут операции.
+    /// Запустить поток ввода/вывода, если он не запущен.
     ///
-    /// По истечению таймаута операция прерывается и считается завершившейся
-    /// неудачно.
+    void startIo();
     ///
-    /// Метод есть синхронный интерфейс к асинхронными операциями ввода. Ввод
-    /// выполняется в отдельном экземпляре boost::asio::io_service, в нем же
-    /// работает таймер. Цикл ввода/вывода исполняется в отдельном потоке,
-    /// запускаемом и останавливаемом в методе.
+    /// Остановить поток ввода/вывода и дождаться его завершения; с общим
+    /// реактором -- дождаться вызова учтенных обработчиков.
     ///
-    void read_until_timeout(boost::asio::streambuf& buf,
-                            const std::string& delim,
-                            boost::system::error_code& ec, uint16_t timeout);
+    void stopIo();
 
     boost::asio::io_service& m_service; ///< Внешний (глобальный) сервис
-                                        ///< ввода/вывода; используется только
-                                        ///< для указания через "сторожа"
-                                        ///< @m_sentinel, что экземпляр данного
-                                        ///< класса не закончил операции
-                                        ///< ввода/вывода.
+                                        ///< ввода/вывода; в нем вызываются
+                                        ///< обработчики асинхронных методов,
+                                        ///< "сторож" @m_sentinel указывает,
+                                        ///< что экземпляр данного класса не
+                                        ///< закончил операции ввода/вывода.
     std::shared_ptr<boost::asio::io_service::work>
       m_sentinel; ///< "Сторож" для внешнего цикла ввода/вывода.
-    boost::asio::io_service m_ioService; ///< Экземпляр службы ввода/вывода
-                                         ///< для асинхронного чтения из
-                                         ///< последовательного порта.
+    std::unique_ptr<boost::asio::io_service>
+      m_ownService; ///< Собственная служба ввода/вывода, если модем создан
+                    ///< без реактора.
+    boost::asio::io_service& m_ioService; ///< Служба ввода/вывода для
+                                          ///< асинхронного обмена с
+                                          ///< последовательным портом:
+                                          ///< собственная или реактора.
     boost::asio::serial_port m_io; ///< Ввод/вывод последовательного порта,
                                    ///< использует m_ioService.
-    boost::asio::steady_timer m_timer; ///< Таймер для асинхронного чтения из
-                                       ///< порта, использует m_ioService.
-    std::mutex m_mutex; ///< Критическая секция -- чтение из порта.
+    boost::asio::steady_timer m_timer; ///< Таймер шага операции, использует
+                                       ///< m_ioService.
+    std::unique_ptr<boost::asio::io_service::work>
+      m_ioWork; ///< "Сторож" цикла ввода/вывода m_ioService.
+    std::thread m_ioThread; ///< Поток цикла ввода/вывода m_ioService; с
+                            ///< общим реактором не используется.
+    std::atomic<bool> m_ioActive; ///< Обмен с портом запущен.
+    std::atomic<unsigned int> m_pending; ///< Учтенные обработчики, еще не
+                                         ///< вызванные.
+    std::mutex m_pendingMutex;
+    std::condition_variable m_pendingCond; ///< Учтенных обработчиков не
+                                           ///< осталось.
+    std::atomic<bool> m_closing; ///< Порт закрывается, новые операции
+                                 ///< отклоняются.
+    // используются только в потоке ввода/вывода
+    std::deque<Operation> m_operations; ///< Очередь команд.
+    bool m_busy; ///< Выполняется операция.
+    bool m_cancelled; ///< Выполняемая операция отменена.
+    bool m_dirty; ///< Ответ прерванной или нераспознанной команды еще может
+                  ///< прийти из порта.
+    std::array<char, 2048> m_rx; ///< Буфер приема; вмещает наибольшее
+                                 ///< MT-сообщение в ответе AT+SBDRB.
+    size_t m_rxBegin, m_rxEnd; ///< Принятые, но не разобранные данные.
+    uint32_t m_stepSeq; ///< Номер шага операции; отсекает срабатывание
+                        ///< таймера предыдущего шага.
+    bool m_timedOut; ///< Шаг прерван по таймеру.
+    bool m_listening; ///< Ожидаются незапрошенные сообщения.
+    std::function<void ()> m_pendingStart; ///< Операция, ждущая прерывания
+                                           ///< ожидания незапрошенных
+                                           ///< сообщений.
+    RingCallback m_ringCallback;
+    IndicatorCallback m_indicatorCallback;
+    std::atomic<int> m_signalQuality; ///< Последнее значение +CIEV:0.
+    std::atomic<int> m_serviceAvailable; ///< Последнее значение +CIEV:1.
     std::string m_deviceName; ///< Наименование устройства в файловой системе,
                               ///< соответствующего последовательному порту.
 };
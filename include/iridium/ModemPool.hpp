@@ -0,0 +1,330 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include "HandlerGuard.hpp"
+#include "Modem.hpp"
+#include "ModemReactor.hpp"
+
+namespace Iridium {
+
+///
+/// Набор модемов одного узла с общей очередью MO-сообщений.
+///
+/// Каждое сообщение очереди передается транзакцией Modem::async_exchange()
+/// через лучший из свободных модемов; модемы работают параллельно, так что
+/// пропускная способность растет с их количеством. Порты всех модемов
+/// обслуживаются одним потоком общего реактора ModemReactor.
+///
+/// Модем выбирается по оценке: уровень сигнала (индикатор +CIEV, иначе
+/// последний известный +CSQF), умноженный на долю успешных сеансов
+/// (скользящее среднее). Оценка незарегистрированного в сети модема
+/// уменьшается вдвое; модем с недоступной сетью или сигналом ниже
+/// setMinSignal() не выбирается. Регистрация и сигнал всех модемов
+/// обновляются одной командной строкой (Modem::async_get_status_snapshot())
+/// с периодом setProbeInterval().
+///
+/// При неудачном сеансе сообщение возвращается в начало очереди и
+/// передается следующим свободным модемом. Для каждого модема действует
+/// "предохранитель", как в GatewayPool: после заданного количества неудач
+/// подряд модем исключается на интервал восстановления, затем через него
+/// пропускается один пробный сеанс.
+///
+/// Доставка подтверждается по MOMSN, как в MoOutbox: если итог сеанса
+/// неизвестен, а MOMSN модема изменился, сообщение считается доставленным
+/// и повторно не передается. MOMSN запрашивается после того, как порт
+/// модема пропустил запоздавший ответ сеанса (см. Modem::cancel()). Если
+/// запрос не удался, итог остается неизвестным: сообщение удерживается
+/// модемом и другим модемам не передается, запрос повторяется с периодом
+/// setProbeInterval(), после close() -- при следующем open(). Если модем
+/// при этом не откроется, сообщение возвращается в очередь.
+///
+/// Обработчики вызываются во внешнем цикле ввода/вывода. Деструктор
+/// дожидается выполняющихся обработчиков набора, а оставшиеся в цикле
+/// (например, завершения прерванных сеансов) к набору уже не обращаются;
+/// уничтожать экземпляр из его же обработчика нельзя.
+///
+class ModemPool: private boost::noncopyable
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t None; ///< Нет подходящего модема.
+    static const unsigned int DefaultFailureThreshold;
+    static const std::chrono::milliseconds DefaultOpenInterval;
+    static const std::chrono::milliseconds DefaultProbeInterval;
+
+    ///
+    /// Состояние "предохранителя" модема.
+    ///
+    enum EState
+    {
+      eClosed, ///< Модем исправен.
+      eOpen, ///< Модем исключен до истечения интервала восстановления.
+      eHalfOpen ///< Выполняется пробный сеанс.
+    };
+
+    ///
+    /// Итог доставки MO-сообщения.
+    ///
+    struct Delivery
+    {
+      uint64_t id; ///< Номер сообщения, выданный post().
+      size_t modem; ///< Номер модема, передавшего сообщение.
+      uint16_t momsn; ///< MOMSN, с которым сообщение передано.
+      unsigned int attempts; ///< Количество попыток на всех модемах.
+      bool inferred; ///< Итог сеанса неизвестен, доставка установлена по
+                     ///< изменению MOMSN.
+
+      Delivery(): id(0), modem(0), momsn(0), attempts(0), inferred(false) {}
+    };
+
+    ///
+    /// Состояние модема.
+    ///
+    struct Status
+    {
+      std::string device;
+      bool open; ///< Порт открыт.
+      bool busy; ///< Выполняется сеанс.
+      EState state;
+      uint8_t net_status; ///< Последнее состояние регистрации (+CREG).
+      int signal; ///< Уровень сигнала, 0-5; -1, если неизвестен.
+      double reliability; ///< Доля успешных сеансов, скользящее среднее.
+      double score; ///< Оценка для выбора; 0 -- модем не выбирается.
+      unsigned int failures; ///< Количество неудач подряд.
+      unsigned long successes; ///< Всего доставленных сообщений.
+      unsigned long errors; ///< Всего неудачных сеансов.
+    };
+
+    typedef std::function<void (const Delivery&)> DeliveryCallback;
+    ///
+    /// Обработчик MT-сообщения: номер модема и сообщение.
+    ///
+    typedef std::function<void (size_t, const std::vector<char>&)> MtCallback;
+
+    ///
+    /// @param [in] service Внешний цикл ввода/вывода модемов.
+    ///
+    ModemPool(boost::asio::io_service& service);
+    ~ModemPool();
+
+    ///
+    /// Добавить модем. Добавлять следует до open().
+    ///
+    /// @param [in] device Последовательный порт модема.
+    /// @return Номер модема в наборе.
+    ///
+    size_t add(const std::string& device);
+    ///
+    /// Модем набора, например для назначения обработчиков до open().
+    ///
+    /// @throw std::out_of_range
+    ///
+    Modem& modem(size_t index);
+
+    ///
+    /// Назначить обработчик доставки сообщения. Назначать следует до
+    /// open().
+    ///
+    inline void setDeliveryCallback(const DeliveryCallback& callback)
+    {
+      m_deliveryCallback = callback;
+    }
+    ///
+    /// Назначить обработчик MT-сообщений, принятых сеансами набора.
+    /// Назначать следует до open().
+    ///
+    inline void setMtCallback(const MtCallback& callback)
+    {
+      m_mtCallback = callback;
+    }
+    ///
+    /// Задать параметры "предохранителя".
+    ///
+    /// @param [in] threshold Количество неудач подряд, после которого модем
+    ///                       исключается; не менее 1.
+    /// @param [in] interval Интервал восстановления.
+    ///
+    void setBreaker(unsigned int threshold,
+                    std::chrono::milliseconds const& interval);
+    ///
+    /// Задать период обновления регистрации и сигнала модемов.
+    ///
+    inline void setProbeInterval(std::chrono::milliseconds const& interval)
+    {
+      m_probeInterval = interval;
+    }
+    ///
+    /// Задать наименьший уровень сигнала для начала сеанса, 0-5.
+    ///
+    inline void setMinSignal(uint8_t quality) { m_minSignal = quality; }
+
+    ///
+    /// Открыть модемы и начать передачу сообщений очереди.
+    ///
+    /// @return Количество открытых модемов. Модемы, которые не удалось
+    ///         открыть, не используются до следующего вызова.
+    ///
+    size_t open();
+    ///
+    /// Закрыть модемы. Прерванные сообщения остаются в очереди; сообщение
+    /// с неизвестным итогом сеанса удерживается модемом до open().
+    ///
+    /// Таймеры набора отменяются в цикле ввода/вывода.
+    ///
+    void close();
+
+    ///
+    /// Поместить сообщение в очередь.
+    ///
+    /// @param [in] payload Сообщение.
+    /// @return Номер сообщения, не равен нулю.
+    /// @throw std::runtime_error Недопустимая длина сообщения.
+    ///
+    /// Метод потокобезопасен.
+    ///
+    uint64_t post(const std::vector<char>& payload);
+    ///
+    /// Количество сообщений, ожидающих модема (без передаваемых).
+    ///
+    size_t size() const;
+    ///
+    /// Количество модемов.
+    ///
+    size_t modems() const;
+    ///
+    /// Состояние всех модемов в порядке добавления.
+    ///
+    std::vector<Status> status() const;
+
+  private:
+    ///
+    /// Сообщение в очереди.
+    ///
+    struct Job
+    {
+      uint64_t id;
+      std::vector<char> payload;
+      unsigned int attempts; ///< Выполненные попытки.
+    };
+
+    struct Unit
+    {
+      std::unique_ptr<Modem> modem;
+      std::unique_ptr<boost::asio::steady_timer> timer; ///< Повтор запроса
+                                                       ///< MOMSN.
+      std::string device;
+      bool open;
+      bool busy;
+      EState state;
+      Clock::time_point until; ///< Окончание исключения (eOpen) или
+                               ///< пробного сеанса (eHalfOpen).
+      uint8_t netStatus;
+      int signal; ///< Последний известный уровень сигнала (+CSQF).
+      double reliability;
+      unsigned int failures;
+      unsigned long successes, errors;
+      Job job; ///< Передаваемое сообщение.
+      uint16_t expectedMomsn; ///< MOMSN передаваемого сообщения.
+      bool unknown; ///< Итог передачи @job неизвестен, MOMSN не получен.
+    };
+
+    ///
+    /// Обработчик, защищенный @m_guard.
+    ///
+    template <class Handler>
+    struct Guarded
+    {
+      HandlerGuard::Weak guard;
+      Handler handler;
+
+      template <class... Args> void operator()(Args&&... args)
+      {
+        HandlerGuard::run(guard, [&]() { handler(args...); });
+      }
+    };
+
+    ///
+    /// Защитить обработчик, передаваемый внешнему циклу ввода/вывода или
+    /// модему, от вызова после уничтожения набора.
+    ///
+    template <class Handler>
+    Guarded<Handler> guard(Handler handler)
+    {
+      return Guarded<Handler>{ m_guard.weak(), std::move(handler) };
+    }
+
+    ///
+    /// Отменить таймеры набора.
+    ///
+    /// Вызывается в цикле ввода/вывода или после закрытия @m_guard.
+    ///
+    void cancelTimers();
+    ///
+    /// Закрыть порты модемов.
+    ///
+    void closeModems();
+    ///
+    /// Оценка модема для выбора.
+    ///
+    /// Вызывается под захваченным мутексом.
+    ///
+    double score(const Unit& unit) const;
+    ///
+    /// Раздать сообщения очереди свободным модемам.
+    ///
+    void dispatch();
+    ///
+    /// Передать сообщение модемом.
+    ///
+    void start(size_t index);
+    void onExchange(size_t index, const boost::system::error_code& ec,
+                    const Modem::ExchangeResult& result);
+    ///
+    /// Установить итог передачи по MOMSN модема; если MOMSN получить не
+    /// удалось, повторить позже, удерживая сообщение.
+    ///
+    void verify(size_t index);
+    void succeeded(size_t index, uint16_t momsn, bool inferred);
+    ///
+    /// Учесть неудачу модема и вернуть сообщение в начало очереди.
+    ///
+    void failed(size_t index);
+    ///
+    /// Обновить регистрацию и сигнал модемов.
+    ///
+    void probe();
+
+    boost::asio::io_service& m_service;
+    boost::asio::steady_timer m_probeTimer;
+    boost::asio::steady_timer m_dispatchTimer; ///< Окончание исключения
+                                               ///< модема.
+    DeliveryCallback m_deliveryCallback;
+    MtCallback m_mtCallback;
+    unsigned int m_threshold;
+    std::chrono::milliseconds m_interval;
+    std::chrono::milliseconds m_probeInterval;
+    uint8_t m_minSignal;
+    std::atomic<bool> m_running;
+    ModemReactor m_reactor; ///< Общий цикл ввода/вывода портов, существует
+                            ///< дольше модемов.
+    std::vector<std::unique_ptr<Unit> > m_units;
+    std::deque<Job> m_queue;
+    uint64_t m_nextId;
+    mutable std::mutex m_mutex;
+    HandlerGuard m_guard; ///< Обработчики во внешнем цикле ввода/вывода.
+}; // class ModemPool
+
+} // namespace Iridium
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace Iridium {
+
+///
+/// Общий цикл ввода/вывода последовательных портов нескольких модемов.
+///
+/// Модем, созданный с реактором, не запускает собственный поток и службу
+/// ввода/вывода: обмен со всеми его портами ведется в единственном потоке
+/// реактора (epoll на Linux). Очередь команд у каждого модема своя, команды
+/// разных модемов выполняются одновременно. Так N модемов обходятся одним
+/// потоком вместо N.
+///
+/// Поток запускается конструктором и останавливается деструктором.
+/// Реактор должен существовать дольше использующих его модемов. Модемы
+/// нельзя закрывать (и уничтожать) в потоке реактора.
+///
+class ModemReactor: private boost::noncopyable
+{
+  public:
+    ModemReactor();
+    ~ModemReactor();
+
+    inline boost::asio::io_service& service() { return m_service; }
+
+  private:
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work>
+      m_work; ///< "Сторож" цикла, пока реактор существует.
+    std::thread m_thread;
+}; // class ModemReactor
+
+} // namespace Iridium
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include "HandlerGuard.hpp"
+#include "IEMtHeader.hpp"
+#include "SbdTransmitter.hpp"
+
+namespace Iridium {
+
+///
+/// Объединение MT-сообщений одному устройству перед отправкой.
+///
+/// Сообщения приложения, поступившие для одного IMEI в течение времени
+/// удержания, упаковываются (см. PayloadFraming) в одну нагрузку
+/// IEMtPayload и отправляются одним MT-сообщением через SbdTransmitter.
+/// Так экономятся сессии DirectIP и сеансы загрузки на устройство.
+///
+/// Время удержания отсчитывается от первого сообщения в пакете. Пакет
+/// отправляется досрочно, если очередное сообщение в него не помещается
+/// (нагрузка не превышает IEMtPayload::MaxPayloadLength). Нулевое время
+/// удержания отключает объединение: каждое сообщение отправляется сразу,
+/// но тоже в упакованном виде, чтобы формат нагрузки на устройстве не
+/// зависел от настройки.
+///
+/// Уникальные идентификаторы MT-сообщений (Unique client message ID)
+/// назначаются объединителем последовательно.
+///
+/// На устройстве нагрузка разбирается функцией PayloadFraming::split().
+///
+/// Таймеры удержания работают в цикле ввода/вывода передатчика. Экземпляр
+/// должен быть уничтожен раньше передатчика, при уничтожении удерживаемые
+/// сообщения отправляются. Уничтожать экземпляр можно в любом потоке:
+/// таймеры, сработавшие к этому моменту, к нему уже не обращаются.
+///
+/// Поскольку пакеты по истечении удержания передаются передатчику в
+/// цикле ввода/вывода, политика переполнения SbdTransmitter::eBlock с
+/// объединителем неприменима.
+///
+class MtCoalescer: private boost::noncopyable
+{
+  public:
+    static const std::chrono::milliseconds DefaultHoldTime;
+
+    ///
+    /// @param [in] service Цикл ввода/вывода таймеров удержания.
+    /// @param [in] transmitter Передатчик.
+    /// @param [in] holdTime Время удержания.
+    /// @param [in] flags Флаги отправляемых MT-сообщений.
+    ///
+    MtCoalescer(boost::asio::io_service& service, SbdTransmitter& transmitter,
+                std::chrono::milliseconds const& holdTime = DefaultHoldTime,
+                SbdDirectIp::MtMessageFlags flags = SbdDirectIp::MtMessageFlags());
+    ~MtCoalescer();
+
+    ///
+    /// Изменить время удержания.
+    ///
+    /// Действует для пакетов, создаваемых после вызова.
+    ///
+    void setHoldTime(std::chrono::milliseconds const& holdTime);
+
+    ///
+    /// Поместить сообщение в пакет устройства.
+    ///
+    /// @param [in] imei IMEI устройства.
+    /// @param [in] data Сообщение приложения.
+    /// @param [in] size Длина сообщения.
+    /// @param [in] callback Функция, вызываемая с итогом отправки пакета.
+    /// @return "Обещание" итога отправки пакета, в который попало
+    ///         сообщение.
+    /// @throw std::runtime_error Упакованное сообщение длиннее
+    ///                           IEMtPayload::MaxPayloadLength.
+    ///
+    SbdTransmitter::TransmitHandle post(
+      const std::string& imei, const char* data, size_t size,
+      const SbdTransmitter::TransmitCallback& callback =
+        SbdTransmitter::TransmitCallback()
+    );
+
+    ///
+    /// Отправить все удерживаемые пакеты.
+    ///
+    void flush();
+    ///
+    /// Отправить удерживаемый пакет устройства.
+    ///
+    void flush(const std::string& imei);
+
+    ///
+    /// Количество устройств с удерживаемыми пакетами.
+    ///
+    size_t pendingDevices() const;
+
+  private:
+    ///
+    /// Сообщение приложения в пакете.
+    ///
+    struct Part
+    {
+      std::promise<SbdTransmitter::TransmitReport> promise;
+      SbdTransmitter::TransmitCallback callback;
+    };
+
+    ///
+    /// Пакет сообщений устройству.
+    ///
+    struct Batch
+    {
+      std::vector<char> payload; ///< Упакованные сообщения.
+      std::vector<std::shared_ptr<Part> > parts;
+      std::shared_ptr<boost::asio::steady_timer> timer; ///< Таймер удержания.
+    };
+
+    ///
+    /// Отправить пакет через передатчик.
+    ///
+    /// Вызывается без захваченного мутекса.
+    ///
+    void send(const std::string& imei, Batch& batch);
+
+    boost::asio::io_service& m_service;
+    SbdTransmitter& m_transmitter;
+    std::chrono::milliseconds m_holdTime;
+    SbdDirectIp::MtMessageFlags m_flags;
+    uint32_t m_msgId; ///< Идентификатор следующего MT-сообщения.
+    std::map<std::string, Batch> m_batches; ///< Пакеты по IMEI.
+    mutable std::mutex m_mutex;
+    HandlerGuard m_guard; ///< Обработчики таймеров удержания.
+}; // class MtCoalescer
+
+} // namespace Iridium
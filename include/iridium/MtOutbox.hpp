@@ -0,0 +1,144 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+namespace Iridium {
+
+///
+/// Постоянное хранилище неподтвержденных MT-сообщений ("исходящие").
+///
+/// Хранилище -- журнал, дописываемый только в конец и разбитый на сегменты
+/// фиксированного размера, отображаемые в память. В журнал пишутся записи
+/// двух видов: сообщение (сериализованный кадр DirectIP с порядковым номером)
+/// и подтверждение (номер сообщения, получившего итог). Сообщения без
+/// подтверждения восстанавливаются методом recover() после перезапуска.
+///
+/// Запись в журнал -- копирование в отображенную память, сброс на диск
+/// выполняется групповым способом методом commit(), который вызывающая
+/// сторона выполняет периодически. Записи, сделанные после последнего
+/// commit(), могут быть потеряны при аварии системы (но не процесса).
+///
+/// Сегмент удаляется, когда все сообщения в нем и во всех более старых
+/// сегментах подтверждены.
+///
+/// Методы класса потокобезопасны.
+///
+class MtOutbox: private boost::noncopyable
+{
+  public:
+    static const size_t DefaultSegmentSize; ///< 4 МиБ.
+
+    ///
+    /// Восстановленное сообщение.
+    ///
+    struct Record
+    {
+      uint64_t sequence; ///< Порядковый номер в журнале.
+      std::vector<char> frame; ///< Кадр DirectIP, включая заголовок.
+    };
+
+    ///
+    /// @param [in] directory Каталог журнала, должен существовать.
+    /// @param [in] segmentSize Размер сегмента в байтах.
+    ///
+    MtOutbox(const std::string& directory,
+             size_t segmentSize = DefaultSegmentSize);
+    ~MtOutbox();
+
+    inline bool isOpen() const { return m_open; }
+
+    ///
+    /// Открыть журнал и прочитать имеющиеся сегменты.
+    ///
+    /// @throw std::runtime_error
+    ///
+    /// Поврежденный или недописанный хвост сегмента отбрасывается.
+    ///
+    void open();
+    ///
+    /// Сбросить журнал на диск и закрыть.
+    ///
+    void close();
+
+    ///
+    /// Получить сообщения, не получившие подтверждения.
+    ///
+    /// @param [out] out Сообщения в порядке записи в журнал.
+    ///
+    void recover(std::vector<Record>& out) const;
+
+    ///
+    /// Записать сообщение в журнал.
+    ///
+    /// @param [in] frame Кадр DirectIP.
+    /// @return Порядковый номер сообщения, не равен нулю.
+    /// @throw std::runtime_error
+    ///
+    uint64_t append(const std::vector<char>& frame);
+    ///
+    /// Записать подтверждение итога сообщения.
+    ///
+    /// @param [in] sequence Порядковый номер сообщения.
+    /// @throw std::runtime_error
+    ///
+    void acknowledge(uint64_t sequence);
+    ///
+    /// Сбросить на диск все записи, сделанные после предыдущего вызова.
+    ///
+    /// @throw std::runtime_error
+    ///
+    void commit();
+
+    ///
+    /// Количество неподтвержденных сообщений.
+    ///
+    size_t size() const;
+
+  private:
+    struct Segment;
+    typedef std::shared_ptr<Segment> SegmentPtr;
+
+    ///
+    /// Положение сообщения в журнале.
+    ///
+    struct Location
+    {
+      uint64_t segment; ///< Индекс сегмента.
+      size_t offset; ///< Смещение записи в сегменте.
+    };
+
+    ///
+    /// Дописать запись в текущий сегмент, при необходимости создав новый.
+    ///
+    /// Вызывается под захваченным мутексом.
+    ///
+    void write(uint8_t type, uint64_t sequence, const char* data, size_t size);
+    SegmentPtr createSegment(uint64_t index);
+    void scanSegment(const SegmentPtr& segment);
+    Segment& segmentAt(uint64_t index) const;
+    ///
+    /// Удалить старейшие сегменты, в которых не осталось сообщений без
+    /// подтверждения.
+    ///
+    void removeSegments();
+
+    std::string m_directory;
+    size_t m_segmentSize;
+    bool m_open;
+    uint64_t m_nextSequence; ///< Номер следующего сообщения.
+    std::deque<SegmentPtr> m_segments; ///< Сегменты от старых к новым.
+    std::vector<SegmentPtr> m_unsynced; ///< Заполненные сегменты, ожидающие
+                                        ///< сброса на диск.
+    std::map<uint64_t, Location> m_live; ///< Неподтвержденные сообщения
+                                         ///< по порядковым номерам.
+    mutable std::mutex m_mutex;
+}; // class MtOutbox
+
+} // namespace Iridium
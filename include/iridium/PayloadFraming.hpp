@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Iridium {
+
+namespace SbdDirectIp {
+
+class MoMessage;
+
+} // namespace Iridium::SbdDirectIp
+
+///
+/// Упаковка нескольких сообщений приложения в одну полезную нагрузку SBD.
+///
+/// Каждое сообщение предваряется длиной в два байта (сетевой порядок
+/// байтов). Формат одинаков для MT- и MO-направлений, поэтому одна и та же
+/// функция split() разбирает нагрузку как на устройстве, так и на сервере.
+///
+class PayloadFraming
+{
+  public:
+    static const size_t HeaderSize = 2; ///< Размер префикса длины.
+    static const size_t MaxFrameLength = 0xFFFF; ///< Наибольшая длина
+                                                 ///< сообщения.
+
+    ///
+    /// Размер упакованного сообщения.
+    ///
+    static inline size_t framedSize(size_t size) { return HeaderSize + size; }
+
+    ///
+    /// Дописать сообщение в нагрузку.
+    ///
+    /// @param [in,out] out Нагрузка.
+    /// @param [in] data Сообщение.
+    /// @param [in] size Длина сообщения.
+    /// @throw std::runtime_error Сообщение длиннее MaxFrameLength.
+    ///
+    static void pack(std::vector<char>& out, const char* data, size_t size);
+    ///
+    /// Разобрать нагрузку на сообщения.
+    ///
+    /// @param [in] payload Нагрузка.
+    /// @param [in] size Длина нагрузки.
+    /// @param [out] out Сообщения дописываются в конец в порядке упаковки.
+    /// @throw std::runtime_error Нагрузка повреждена или обрезана.
+    ///
+    static void split(const char* payload, size_t size,
+                      std::vector<std::vector<char> >& out);
+    ///
+    /// Разобрать нагрузку MO-сообщения DirectIP на записи (см. MoPacker).
+    ///
+    /// @throw std::runtime_error Нагрузка повреждена или обрезана.
+    ///
+    static void split(const SbdDirectIp::MoMessage& message,
+                      std::vector<std::vector<char> >& out);
+}; // class PayloadFraming
+
+} // namespace Iridium
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "QueueStats.hpp"
+
+///
+/// Шаблонный класс очереди задач с приоритетами.
+///
+/// Задания раскладываются по "корзинам" уровней приоритета, уровень 0 --
+/// наивысший. Внутри уровня соблюдается порядок поступления. Постановка в
+/// очередь и извлечение выполняются за O(1): число уровней фиксируется при
+/// создании очереди, при извлечении просматриваются только головы корзин.
+///
+/// Чтобы задания низкого приоритета не "голодали", используется старение:
+/// за каждый интервал @aging ожидания в очереди эффективный приоритет задания
+/// повышается на один уровень. Из голов корзин извлекается задание с
+/// наименьшим эффективным уровнем, при равенстве -- дольше ожидающее.
+///
+/// Интерфейс повторяет JobUnitQueue, но методы постановки в очередь
+/// дополнительно принимают уровень приоритета задания.
+///
+/// К очереди можно подключить статистику Iridium::QueueStats (см.
+/// setStats()); время ожидания задания отсчитывается от его постановки в
+/// очередь. Задание, которое извлекается лишь для того, чтобы быть
+/// отложенным и возвращенным позже, извлекается методом take() и
+/// возвращается методом restore(): эти переходы в статистике не
+/// учитываются, а время постановки задания сохраняется.
+///
+/// @author golovin
+///
+template <class Job> class PriorityJobQueue
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    ///
+    /// @param [in] levels Количество уровней приоритета, не менее одного.
+    /// @param [in] aging Интервал старения; нулевой интервал отключает
+    ///                   старение.
+    ///
+    PriorityJobQueue(size_t levels, std::chrono::milliseconds aging):
+      buckets(levels ? levels : 1), aging(aging), total(0)
+    {}
+
+    ///
+    /// Поместить очередное задание в очередь.
+    ///
+    /// @param [in] job Помещаемое задание.
+    /// @param [in] level Уровень приоритета; уровни за пределами диапазона
+    ///                   приводятся к наинизшему.
+    /// @param [in] stamp Время постановки в очередь.
+    ///
+    inline void put(const Job& job, size_t level,
+                    Clock::time_point stamp = Clock::now())
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      level = clamp(level);
+      buckets[level].push_back(Entry(job, stamp));
+      total++;
+      if (stats) stats->onEnqueue();
+    }
+    inline void put(Job&& job, size_t level,
+                    Clock::time_point stamp = Clock::now())
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      level = clamp(level);
+      buckets[level].push_back(Entry(std::move(job), stamp));
+      total++;
+      if (stats) stats->onEnqueue();
+    }
+
+    ///
+    /// Извлечь очередное задание из очереди.
+    ///
+    /// @param [out] level Уровень приоритета, с которым задание было
+    ///                    помещено в очередь (если указатель не нулевой).
+    /// @return Задание.
+    ///
+    /// Если в очереди заданий нет, возвращает "пустое" задание,
+    /// созданное конструктором по умолчанию класса Job.
+    ///
+    inline Job get(size_t* level = nullptr)
+    {
+      return extract(level, nullptr, true);
+    }
+
+    ///
+    /// Извлечь очередное задание, не учитывая извлечение в статистике.
+    ///
+    /// @param [out] level Уровень приоритета задания (если указатель не
+    ///                    нулевой).
+    /// @param [out] stamp Время постановки задания в очередь (если указатель
+    ///                    не нулевой).
+    /// @return Задание или "пустое" задание, если очередь пуста.
+    ///
+    /// Задание считается по-прежнему ожидающим: оно возвращается методом
+    /// restore(), а окончательное извлечение учитывает вызывающий.
+    ///
+    inline Job take(size_t* level = nullptr, Clock::time_point* stamp = nullptr)
+    {
+      return extract(level, stamp, false);
+    }
+
+    ///
+    /// Вернуть задание в начало корзины его уровня приоритета.
+    ///
+    /// @param [in] job Возвращаемое задание.
+    /// @param [in] level Уровень приоритета задания.
+    /// @param [in] stamp Время первоначальной постановки задания в очередь;
+    ///                   от него отсчитываются старение и время ожидания.
+    ///
+    /// Возврат учитывается в статистике как постановка в очередь.
+    ///
+    inline void unget(const Job& job, size_t level, Clock::time_point stamp)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      buckets[clamp(level)].push_front(Entry(job, stamp));
+      total++;
+      if (stats) stats->onEnqueue();
+    }
+
+    ///
+    /// Вернуть задание, извлеченное take(), без учета в статистике.
+    ///
+    /// @param [in] job Возвращаемое задание.
+    /// @param [in] level Уровень приоритета задания.
+    /// @param [in] stamp Время первоначальной постановки задания в очередь.
+    ///
+    inline void restore(const Job& job, size_t level, Clock::time_point stamp)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      buckets[clamp(level)].push_front(Entry(job, stamp));
+      total++;
+    }
+
+    ///
+    /// Ожидать появления задания в очереди с таймаутом.
+    ///
+    /// @param [in] abs_time Таймаут в миллисекундах.
+    /// @return Возвращает true, если время ожидания истекло.
+    ///
+    inline bool wait_for(std::chrono::milliseconds const& abs_time)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (total) return false;
+      return (cond.wait_for(lock, abs_time) == std::cv_status::timeout);
+    }
+
+    ///
+    /// Отправить уведомление о появлении задания в очереди.
+    ///
+    /// Уведомление следует делать явно. При добавлении задания в очередь
+    /// методом put() этот метод не вызывается.
+    ///
+    inline void notify_one()
+    {
+      cond.notify_one();
+    }
+
+    ///
+    /// Очистить очередь задач.
+    ///
+    inline void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      for (auto& bucket: buckets) bucket.clear();
+      if (stats) stats->onRemove(total);
+      total = 0;
+    }
+
+    ///
+    /// Очистить очередь задач, вернув удаленные задания.
+    ///
+    /// @param [out] removed Удаленные задания дописываются в конец в порядке
+    ///                      уровней приоритета.
+    ///
+    inline void clear(std::vector<Job>& removed)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      removed.reserve(removed.size() + total);
+      for (auto& bucket: buckets)
+      {
+        for (auto& entry: bucket) removed.push_back(entry.job);
+        bucket.clear();
+      }
+      if (stats) stats->onRemove(total);
+      total = 0;
+    }
+
+    ///
+    /// Вытеснить из очереди самое старое задание.
+    ///
+    /// @param [out] job Вытесненное задание.
+    /// @return false, если очередь пуста.
+    ///
+    inline bool evictOldest(Job& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      size_t oldest = buckets.size();
+      for (size_t i = 0; i < buckets.size(); i++)
+      {
+        if (buckets[i].empty()) continue;
+        if ((oldest == buckets.size()) ||
+            (buckets[i].front().stamp < buckets[oldest].front().stamp))
+          oldest = i;
+      }
+      if (oldest == buckets.size()) return false;
+      job = buckets[oldest].front().job;
+      buckets[oldest].pop_front();
+      total--;
+      if (stats) stats->onRemove(1);
+      return true;
+    }
+
+    ///
+    /// Вытеснить из очереди самое новое задание наинизшего приоритета.
+    ///
+    /// @param [in] above Вытесняются только задания с уровнем приоритета
+    ///                   больше указанного (т.е. менее приоритетные).
+    /// @param [out] job Вытесненное задание.
+    /// @return false, если подходящих заданий нет.
+    ///
+    inline bool evictLowest(size_t above, Job& job)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      for (size_t i = buckets.size(); i > above + 1; i--)
+      {
+        auto& bucket = buckets[i - 1];
+        if (bucket.empty()) continue;
+        job = bucket.back().job;
+        bucket.pop_back();
+        total--;
+        if (stats) stats->onRemove(1);
+        return true;
+      }
+      return false;
+    }
+
+    ///
+    /// Изменить интервал старения.
+    ///
+    inline void setAging(std::chrono::milliseconds const& interval)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      aging = interval;
+    }
+
+    ///
+    /// Подключить статистику очереди.
+    ///
+    /// @param [in] s Статистика; нулевой указатель отключает ее. Задания,
+    ///               уже находящиеся в очереди, не учитываются.
+    ///
+    inline void setStats(const std::shared_ptr<Iridium::QueueStats>& s)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      stats = s;
+    }
+
+    inline size_t levels() const { return buckets.size(); }
+
+    inline size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      return total;
+    }
+
+    ///
+    /// Количество заданий указанного уровня приоритета.
+    ///
+    inline size_t size(size_t level) const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      return (level < buckets.size()) ? buckets[level].size() : 0;
+    }
+
+  private:
+    struct Entry
+    {
+      Job job;
+      Clock::time_point stamp; ///< Время постановки в очередь.
+
+      Entry(const Job& j, Clock::time_point s): job(j), stamp(s) {}
+      Entry(Job&& j, Clock::time_point s): job(std::move(j)), stamp(s) {}
+    };
+
+    inline Job extract(size_t* level, Clock::time_point* stamp, bool counted)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      (void)lock;
+      Job job;
+      size_t selected = select();
+      if (selected < buckets.size())
+      {
+        Entry& head = buckets[selected].front();
+        job = std::move(head.job);
+        if (stats && counted) stats->onDequeue(Clock::now() - head.stamp);
+        if (level) *level = selected;
+        if (stamp) *stamp = head.stamp;
+        buckets[selected].pop_front();
+        total--;
+      }
+      return job;
+    }
+
+    inline size_t clamp(size_t level) const
+    {
+      return (level < buckets.size()) ? level : buckets.size() - 1;
+    }
+
+    ///
+    /// Выбрать корзину, из которой следует извлечь задание.
+    ///
+    /// @return Номер корзины или buckets.size(), если очередь пуста.
+    ///
+    /// Вызывается под захваченным мутексом.
+    ///
+    size_t select() const
+    {
+      size_t selected = buckets.size();
+      if (!total) return selected;
+      Clock::time_point now = Clock::now();
+      size_t bestLevel = 0;
+      Clock::time_point bestStamp;
+      for (size_t i = 0; i < buckets.size(); i++)
+      {
+        if (buckets[i].empty()) continue;
+        const Entry& head = buckets[i].front();
+        size_t effective = i;
+        if (aging.count() > 0)
+        {
+          auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - head.stamp
+          );
+          size_t promotion = waited.count() / aging.count();
+          effective = (promotion < i) ? i - promotion : 0;
+        }
+        if ((selected == buckets.size()) || (effective < bestLevel) ||
+            ((effective == bestLevel) && (head.stamp < bestStamp)))
+        {
+          selected = i;
+          bestLevel = effective;
+          bestStamp = head.stamp;
+        }
+      }
+      return selected;
+    }
+
+    std::vector<std::deque<Entry> > buckets; ///< Корзины уровней приоритета.
+    std::chrono::milliseconds aging; ///< Интервал старения.
+    size_t total; ///< Общее количество заданий.
+    std::shared_ptr<Iridium::QueueStats> stats;
+    mutable std::mutex mutex; ///< Мутекс корзин и переменной состояния.
+    std::condition_variable cond; ///< Переменная состояния для сигнала о
+                                  ///< появлении нового задания.
+};
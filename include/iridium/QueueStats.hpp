@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+
+namespace Iridium {
+
+///
+/// Статистика очереди заданий.
+///
+/// Счетчики -- атомарные переменные, обновляются без блокировок теми
+/// потоками, что работают с очередью. Снимок snapshot() также читается без
+/// блокировок и при одновременных изменениях может быть несогласован в
+/// пределах нескольких заданий.
+///
+/// Время ожидания в очереди (от постановки до извлечения) учитывается в
+/// гистограмме с логарифмической шкалой: корзина 0 -- менее 1 мс, корзина
+/// i -- от 2^(i-1) до 2^i мс, последняя корзина не ограничена сверху.
+///
+class QueueStats
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t Buckets = 24; ///< Количество корзин гистограммы.
+
+    ///
+    /// Снимок статистики.
+    ///
+    struct Snapshot
+    {
+      size_t depth; ///< Текущая глубина очереди.
+      size_t highWater; ///< Наибольшая глубина очереди.
+      uint64_t enqueued; ///< Постановок в очередь, включая возвраты.
+      uint64_t dequeued; ///< Извлечений из очереди.
+      uint64_t removed; ///< Заданий, удаленных без извлечения.
+      std::array<uint64_t, Buckets> latency; ///< Гистограмма ожидания.
+      std::chrono::microseconds totalLatency; ///< Суммарное ожидание.
+      std::chrono::microseconds maxLatency; ///< Наибольшее ожидание.
+
+      Snapshot();
+
+      ///
+      /// Верхняя граница корзины гистограммы.
+      ///
+      /// @return Для последней корзины -- Clock::duration::max().
+      ///
+      static Clock::duration bucketLimit(size_t bucket);
+      ///
+      /// Оценка сверху процентиля времени ожидания.
+      ///
+      /// @param [in] p Процентиль, 0-100.
+      /// @return Верхняя граница корзины, в которую попадает процентиль;
+      ///         ноль, если заданий не извлекалось.
+      ///
+      Clock::duration percentile(double p) const;
+      ///
+      /// Среднее время ожидания.
+      ///
+      std::chrono::microseconds meanLatency() const;
+    };
+
+    QueueStats();
+
+    ///
+    /// Учесть постановку задания в очередь.
+    ///
+    void onEnqueue();
+    ///
+    /// Учесть извлечение задания.
+    ///
+    /// @param [in] waited Время, проведенное заданием в очереди.
+    ///
+    void onDequeue(Clock::duration waited);
+    ///
+    /// Учесть удаление заданий без извлечения (очистка, вытеснение).
+    ///
+    void onRemove(size_t count);
+
+    Snapshot snapshot() const;
+    ///
+    /// Сбросить наибольшую глубину к текущей.
+    ///
+    void resetHighWater();
+
+  private:
+    std::atomic<size_t> m_depth, m_highWater;
+    std::atomic<uint64_t> m_enqueued, m_dequeued, m_removed;
+    std::array<std::atomic<uint64_t>, Buckets> m_latency;
+    std::atomic<uint64_t> m_totalLatency, m_maxLatency; ///< мкс
+}; // class QueueStats
+
+} // namespace Iridium
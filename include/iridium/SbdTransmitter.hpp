@@ -1,13 +1,26 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/signals2/signal.hpp>
-#include "JobUnitQueue.hpp"
+#include "GatewayPool.hpp"
+#include "HandlerGuard.hpp"
+#include "IEMtConfirmationMsg.hpp"
 #include "Message.hpp"
+#include "MtOutbox.hpp"
+#include "PriorityJobQueue.hpp"
+#include "TcpConnector.hpp"
+#include "TokenBucket.hpp"
 
 namespace Iridium {
 
@@ -15,27 +28,199 @@ namespace Iridium {
 /// Класс-передатчик SBD-сообщений через DirectIP.
 ///
 /// Сообщения отправляются асинхронно в отдельном потоке в порядке
-/// поступления. Передатчик запускается методом start(), в котором создается
-/// поток исполнения. Останавливается передатчик методом stop(). Экземпляр
+/// приоритета, внутри одного приоритета -- в порядке поступления. Приоритет
+/// сообщения учитывается, если в его заголовке установлен флаг
+/// MtMessageFlags::highPriority; иначе сообщение получает наинизший приоритет
+/// IEMtPriority::MinPriority. Сообщения низкого приоритета со временем
+/// "стареют" и не блокируются бесконечно потоком срочных сообщений, интервал
+/// старения задается методом setPriorityAging().
+///
+/// Передатчик запускается методом start(), в котором создается поток
+/// исполнения. Останавливается передатчик методом stop(). Экземпляр
 /// передатчика можно запускать и останавливать без ограничений.
 ///
 /// Чтобы поместить сообщение в очередь на отправку используется метод post().
-/// Для формирования сообщений используется метод factory() класса Codec. В
-/// случае неудачной отправки сообщение возвращается в начало очереди.
+/// Для формирования сообщений используется метод factory() класса Codec.
+/// Сообщение сериализуется один раз в post(), в очереди хранится только
+/// неизменяемый кадр, разделяемый попытками отправки и журналом исходящих.
+/// В случае неудачной отправки сообщение возвращается в начало очереди и
+/// при повторе отправляются те же байты.
+///
+/// Метод post() возвращает "обещание" (std::shared_future) итога отправки
+/// TransmitReport, который содержит подтверждение "Иридиума" целиком и
+/// временные отметки. Итог можно также получить через функцию обратного
+/// вызова, переданную в post(), или через сигнал OnTransmitReportConnect().
+/// Это позволяет держать в очереди множество неподтвержденных сообщений и
+/// сопоставлять подтверждения с отправленными сообщениями.
+///
+/// Реакция на отрицательный статус в подтверждении "Иридиума" задается
+/// политикой повтора для каждого значения IEMtConfirmationMsg::EMsgStatus
+/// (см. setRetryPolicy()). Ошибки, относящиеся к конкретному устройству,
+/// не останавливают передачу сообщений другим устройствам: сообщения такого
+/// устройства откладываются в его собственную очередь с независимой
+/// экспоненциальной задержкой, а сообщения с заведомо неисправимыми ошибками
+/// (неверный или неизвестный IMEI и т.п.) отбрасываются с итогом
+/// TransmitReport::eRejected.
+///
+/// Положительный статус подтверждения -- позиция сообщения в очереди
+/// устройства на шлюзе "Иридиума", очередь вмещает не более
+/// IEMtConfirmationMsg::MaxQueueLength сообщений. Передатчик запоминает
+/// последнюю известную глубину очереди каждого устройства и, когда она
+/// достигает порога (см. setGatewayQueueLimit()), придерживает сообщения
+/// устройства, не дожидаясь ошибки eQueueFull. Удержание снимается вызовом
+/// deviceCheckedIn(), когда от устройства приходит MO-сообщение (сеанс
+/// связи устройства забирает очередь MT-сообщений), либо по истечении
+/// таймаута.
+///
+/// Количество принятых, но еще не получивших итог сообщений можно
+/// ограничить методом setCapacity(). При переполнении post() в зависимости
+/// от политики ожидает освобождения места, отвергает сообщение исключением
+/// или вытесняет сообщение из очереди (самое старое либо наименее
+/// приоритетное) с итогом TransmitReport::eDropped.
+///
+/// Сообщения можно сохранять в постоянном журнале исходящих MtOutbox
+/// (см. setOutbox()). Сообщение пишется в журнал при помещении в очередь,
+/// при получении итога в журнал пишется подтверждение. При запуске
+/// передатчика сообщения без подтверждения восстанавливаются из журнала в
+/// очередь. Журнал сбрасывается на диск группами по собственному таймеру
+/// в цикле ввода/вывода с периодом Heartbeat, независимо от сессий.
 ///
-/// Очередь сообщений можно опустошить вызовом dropMessages().
+/// Передатчик может работать с несколькими шлюзами DirectIP (см.
+/// GatewayPool). Шлюз выбирается для каждой сессии, ошибки соединения и
+/// протокола учитываются "предохранителем" шлюза. Неудачная попытка сразу
+/// повторяется через другой доступный шлюз, общая задержка передатчика
+/// применяется, только когда доступных шлюзов не осталось.
+///
+/// Соединение со шлюзом устанавливается параллельными попытками по всем
+/// адресам шлюза со смещением во времени (см. TcpConnector и
+/// setConnectStagger()). Пока ожидается подтверждение текущего сообщения
+/// и в очереди есть следующее, заранее устанавливается запасное соединение
+/// с тем же шлюзом; очередная сессия использует его, не тратя время на
+/// разрешение имени и установку соединения (см. setConnectionPrewarm()).
+///
+/// Темп открытия сессий можно ограничить общим ограничителем и
+/// ограничителем для каждого устройства (см. setRateLimit() и
+/// setDeviceRateLimit()). Сообщения, превышающие темп, ожидают в очереди
+/// (сообщения устройства -- среди его отложенных сообщений) и не
+/// отбрасываются.
+///
+/// Очередь сообщений можно опустошить вызовом dropMessages(). Сообщения,
+/// оставшиеся в очереди при уничтожении передатчика, получают итог
+/// TransmitReport::eDropped (в журнале исходящих они сохраняются).
 ///
 class SbdTransmitter
 {
   public:
+    typedef std::chrono::steady_clock Clock;
+
+    ///
+    /// Итог отправки MT-сообщения.
+    ///
+    struct TransmitReport
+    {
+      enum EOutcome
+      {
+        eConfirmed, ///< "Иридиум" подтвердил прием сообщения.
+        eRejected, ///< "Иридиум" отверг сообщение, повтор бесполезен.
+        eDropped ///< Сообщение удалено из очереди без отправки.
+      };
+
+      EOutcome outcome;
+      uint32_t messageId; ///< Unique client message ID из заголовка сообщения.
+      std::string imei;
+      std::string gateway; ///< Шлюз последней попытки, "host:port".
+      uint32_t autoRef; ///< Auto ID reference из подтверждения.
+      int16_t status; ///< Поле "MT Message Status" последнего подтверждения.
+      uint16_t queuePosition; ///< Позиция сообщения в очереди устройства на
+                              ///< шлюзе "Иридиума", 0 -- неизвестна.
+      unsigned int attempts; ///< Количество попыток отправки.
+      Clock::time_point posted; ///< Время помещения в очередь.
+      Clock::time_point sent; ///< Начало последней попытки отправки.
+      Clock::time_point completed; ///< Время получения итога.
+
+      ///
+      /// Длительность этапов последней попытки отправки.
+      ///
+      struct Timing
+      {
+        Clock::duration resolve; ///< Разрешение DNS-имени шлюза.
+        Clock::duration connect; ///< Установка TCP-соединения.
+        Clock::duration write; ///< Передача сообщения.
+        Clock::duration confirmation; ///< Ожидание и прием подтверждения.
+
+        Timing(): resolve(0), connect(0), write(0), confirmation(0) {}
+      } timing;
+
+      TransmitReport():
+        outcome(eDropped), messageId(0), autoRef(0), status(0),
+        queuePosition(0), attempts(0)
+      {}
+    };
+
+    ///
+    /// Политика повтора при отрицательном статусе подтверждения.
+    ///
+    enum ERetryPolicy
+    {
+      eRetry, ///< Вернуть сообщение в начало очереди и повторить отправку
+              ///< после общей задержки передатчика (неисправность шлюза).
+      eDelayDevice, ///< Отложить сообщения устройства, не задерживая
+                    ///< передачу другим устройствам.
+      eDrop ///< Отбросить сообщение.
+    };
+
+    ///
+    /// Политика при переполнении очереди на отправку.
+    ///
+    enum EOverflowPolicy
+    {
+      eBlock, ///< Ожидать освобождения места в очереди.
+      eReject, ///< Отвергнуть новое сообщение исключением.
+      eDropOldest, ///< Вытеснить самое старое сообщение в очереди.
+      eDropLowestPriority ///< Вытеснить самое новое сообщение наинизшего
+                          ///< приоритета; если новое сообщение не
+                          ///< приоритетнее его, отбрасывается новое.
+    };
+
+    ///
+    /// Предельные длительности этапов сессии передачи.
+    ///
+    /// Превышение предела считается ошибкой передачи и обрабатывается как
+    /// прочие ошибки этапа (возврат сообщения в очередь и задержка). Нулевое
+    /// значение отключает предел.
+    ///
+    struct Timeouts
+    {
+      std::chrono::milliseconds resolve; ///< Разрешение DNS-имени шлюза.
+      std::chrono::milliseconds connect; ///< Установка TCP-соединения.
+      std::chrono::milliseconds write; ///< Передача сообщения.
+      std::chrono::milliseconds confirmation; ///< Прием подтверждения.
+
+      Timeouts():
+        resolve(10000), connect(10000), write(10000), confirmation(30000)
+      {}
+    };
+
+    typedef std::shared_future<TransmitReport> TransmitHandle;
+    typedef std::function<void (const TransmitReport&)> TransmitCallback;
+
     // передается сообщение об ошибке
     typedef boost::signals2::signal<void (const std::string&)> SignalOnError;
     // передается статус отправки, возвращаемый "Иридиумом" в поле "MT Message
     // Status" сообщения "MT Message Confirmation"
     typedef boost::signals2::signal<void (int16_t)> SignalOnTransmitResult;
+    // передается итог отправки сообщения
+    typedef boost::signals2::signal<void (const TransmitReport&)> SignalOnTransmitReport;
 
     SbdTransmitter(boost::asio::io_service& service, const std::string& host,
                    const std::string& port);
+    ///
+    /// @param [in] gateways Набор шлюзов, может разделяться несколькими
+    ///                      передатчиками.
+    /// @throw std::invalid_argument Пустой набор.
+    ///
+    SbdTransmitter(boost::asio::io_service& service,
+                   const std::shared_ptr<GatewayPool>& gateways);
     ~SbdTransmitter();
 
     inline boost::signals2::connection OnErrorConnect(
@@ -50,19 +235,260 @@ class SbdTransmitter
     {
       return m_emitOnTransmitResult.connect(subscriber);
     }
+    inline boost::signals2::connection OnTransmitReportConnect(
+      const SignalOnTransmitReport::slot_type& subscriber
+    )
+    {
+      return m_emitOnTransmitReport.connect(subscriber);
+    }
+
+    ///
+    /// Набор шлюзов передатчика.
+    ///
+    inline std::shared_ptr<GatewayPool> gateways() const { return m_gateways; }
+
+    ///
+    /// Опустошить очередь сообщений.
+    ///
+    /// Итог удаленных сообщений -- TransmitReport::eDropped.
+    ///
+    void dropMessages();
+
+    ///
+    /// Задать интервал старения сообщений в очереди.
+    ///
+    /// @param [in] interval Время ожидания, за которое приоритет сообщения
+    ///                      повышается на один уровень; ноль отключает
+    ///                      старение.
+    ///
+    inline void setPriorityAging(std::chrono::milliseconds const& interval)
+    {
+      m_messageQueue.setAging(interval);
+    }
 
-    inline void dropMessages() { m_messageQueue.clear(); }
+    ///
+    /// Ограничить количество сообщений в передатчике.
+    ///
+    /// @param [in] capacity Наибольшее количество сообщений, принятых
+    ///                      post() и еще не получивших итог (в очереди,
+    ///                      отложенных и отправляемое); 0 -- без ограничения.
+    /// @param [in] policy Политика при переполнении.
+    ///
+    /// Политика eBlock имеет смысл только для запущенного передатчика.
+    ///
+    void setCapacity(size_t capacity, EOverflowPolicy policy);
+    ///
+    /// Количество сообщений, принятых post() и еще не получивших итог.
+    ///
+    size_t pendingMessages() const;
+    ///
+    /// Наибольшее значение pendingMessages() с момента создания передатчика.
+    ///
+    size_t highWaterMark() const;
+
+    ///
+    /// Количество сообщений в очереди на отправку.
+    ///
+    inline size_t queueDepth() const { return m_messageQueue.size(); }
+    ///
+    /// Статистика очереди на отправку.
+    ///
+    /// Время ожидания учитывается от помещения сообщения в очередь (или
+    /// возврата в нее после неудачной попытки либо задержки устройства) до
+    /// выбора для отправки. Снимок читается без блокировок.
+    ///
+    inline QueueStats::Snapshot queueStats() const
+    {
+      return m_queueStats->snapshot();
+    }
+    ///
+    /// Количество сообщений, отложенных до истечения задержки устройств.
+    ///
+    size_t deferredDepth() const;
+    ///
+    /// Количество сообщений указанного приоритета в очереди на отправку.
+    ///
+    /// @param [in] priority Приоритет сообщения, 1-5.
+    ///
+    size_t queueDepth(uint16_t priority) const;
 
+    ///
+    /// @throw std::runtime_error Ошибка открытия журнала исходящих.
+    ///
     void start();
     ///
     /// @throw std::runtime_error
     ///
+    /// Ввод/вывод сессии прерывается в цикле ввода/вывода, stop() дожидается
+    /// этого, если цикл работает.
+    ///
     void stop(bool woexcept = false);
-    void post(const SbdDirectIp::MtMessage& message);
+
+    ///
+    /// Использовать постоянный журнал исходящих сообщений.
+    ///
+    /// @param [in] outbox Журнал; если не открыт, открывается в start().
+    /// @throw std::runtime_error Передатчик запущен.
+    ///
+    /// Восстановление неподтвержденных сообщений из журнала выполняется
+    /// при первом после назначения журнала вызове start(). Итоги
+    /// восстановленных сообщений доступны только через сигнал
+    /// OnTransmitReportConnect().
+    ///
+    void setOutbox(const std::shared_ptr<MtOutbox>& outbox);
+
+    ///
+    /// Задать предельные длительности этапов сессии передачи.
+    ///
+    /// Действуют с очередной сессии.
+    ///
+    inline void setTimeouts(const Timeouts& timeouts) { m_timeouts = timeouts; }
+
+    ///
+    /// Задать интервал смещения параллельных попыток соединения.
+    ///
+    inline void setConnectStagger(std::chrono::milliseconds const& stagger)
+    {
+      m_connectStagger = stagger;
+    }
+    ///
+    /// Управлять заблаговременной установкой запасного соединения.
+    ///
+    /// @param [in] maxIdle Наибольшее время простоя запасного соединения,
+    ///                     после которого оно не используется (шлюз мог
+    ///                     его закрыть); 0 -- запасное соединение не
+    ///                     устанавливается.
+    ///
+    inline void setConnectionPrewarm(std::chrono::milliseconds const& maxIdle)
+    {
+      m_spareMaxIdle = maxIdle;
+    }
+
+    ///
+    /// Задать политику повтора для статуса подтверждения.
+    ///
+    /// @param [in] status Отрицательный статус подтверждения "Иридиума".
+    /// @param [in] policy Политика повтора.
+    ///
+    void setRetryPolicy(SbdDirectIp::IEMtConfirmationMsg::EMsgStatus status,
+                        ERetryPolicy policy);
+    ///
+    /// Задать пределы задержки отложенных сообщений устройства.
+    ///
+    /// @param [in] min Начальная задержка.
+    /// @param [in] max Наибольшая задержка.
+    ///
+    /// Задержка удваивается при каждой очередной ошибке устройства и
+    /// сбрасывается при успешной отправке сообщения на устройство.
+    ///
+    void setDeviceBackoff(std::chrono::milliseconds const& min,
+                          std::chrono::milliseconds const& max);
+    ///
+    /// Ограничить общий темп сессий передатчика.
+    ///
+    /// @param [in] rate Сессий в секунду; 0 -- без ограничения.
+    /// @param [in] burst Допустимый всплеск, сессий.
+    ///
+    /// Учитываются все сессии, включая повторные попытки.
+    ///
+    void setRateLimit(double rate, unsigned int burst);
+    ///
+    /// Ограничить темп сессий для каждого устройства-получателя.
+    ///
+    /// @param [in] rate Сессий в секунду для одного IMEI; 0 -- без
+    ///                  ограничения.
+    /// @param [in] burst Допустимый всплеск, сессий.
+    ///
+    void setDeviceRateLimit(double rate, unsigned int burst);
+
+    ///
+    /// Задать порог удержания сообщений по глубине очереди устройства на
+    /// шлюзе.
+    ///
+    /// @param [in] limit Глубина очереди, при которой сообщения устройства
+    ///                   придерживаются; 0 -- не придерживать.
+    /// @param [in] timeout Наибольшее время удержания без сеанса связи
+    ///                     устройства.
+    ///
+    void setGatewayQueueLimit(uint16_t limit,
+                              std::chrono::milliseconds const& timeout);
+    ///
+    /// Сообщить о сеансе связи устройства.
+    ///
+    /// @param [in] imei IMEI устройства.
+    ///
+    /// Вызывается при получении MO-сообщения от устройства. Очередь
+    /// устройства на шлюзе считается опустошенной, удержание его сообщений
+    /// снимается.
+    ///
+    void deviceCheckedIn(const std::string& imei);
+    inline void deviceCheckedIn(const SbdDirectIp::MoMessage& message)
+    {
+      deviceCheckedIn(message.imei());
+    }
+
+    ///
+    /// Поместить сообщение в очередь на отправку.
+    ///
+    /// @param [in] message Сообщение.
+    /// @param [in] callback Функция, вызываемая с итогом отправки в потоке
+    ///                      цикла ввода/вывода.
+    /// @return "Обещание" итога отправки.
+    /// @throw std::runtime_error Очередь переполнена (политика eReject) или
+    ///                           ошибка записи в журнал исходящих.
+    ///
+    TransmitHandle post(const SbdDirectIp::MtMessage& message,
+                        const TransmitCallback& callback = TransmitCallback());
 
   private:
     static const unsigned short int Heartbeat; // ms
     static const unsigned short int MaxDelay;
+    static const std::chrono::milliseconds DefaultAging;
+    static const std::chrono::milliseconds DefaultDeviceMinDelay;
+    static const std::chrono::milliseconds DefaultDeviceMaxDelay;
+    static const uint16_t DefaultGatewayQueueLimit;
+    static const std::chrono::milliseconds DefaultGatewayQueueTimeout;
+    static const std::chrono::milliseconds DefaultSpareMaxIdle;
+
+    ///
+    /// Сообщение в очереди на отправку.
+    ///
+    struct Outgoing
+    {
+      ///
+      /// Состояние отслеживания итога отправки.
+      ///
+      struct Tracker
+      {
+        std::promise<TransmitReport> promise;
+        TransmitCallback callback;
+        TransmitReport report;
+      };
+
+      std::shared_ptr<const std::vector<char> > frame; ///< Сериализованное
+                                                      ///< сообщение.
+      size_t level; ///< Уровень приоритета в очереди.
+      Clock::time_point stamp; ///< Время постановки в очередь; сохраняется
+                               ///< при откладывании и повторах.
+      uint64_t sequence; ///< Номер в журнале исходящих, 0 -- не записано.
+      std::shared_ptr<Tracker> tracker;
+
+      Outgoing(): level(0), sequence(0) {}
+    };
+
+    ///
+    /// Состояние устройства-получателя.
+    ///
+    struct Device
+    {
+      std::vector<Outgoing> deferred; ///< Отложенные сообщения.
+      Clock::time_point until; ///< Окончание задержки.
+      std::chrono::milliseconds delay; ///< Текущая задержка.
+      uint16_t gatewayQueue; ///< Известная глубина очереди устройства на
+                             ///< шлюзе, если сообщения придерживаются.
+
+      Device(): delay(0), gatewayQueue(0) {}
+    };
 
     ///
     /// Состояния конечного автомата при передаче SBD.
@@ -84,24 +510,158 @@ class SbdTransmitter
     void closeSocket();
     void logMessage(SbdDirectIp::MtConfirmMessage& message);
     void StateMachine();
+    static size_t priorityLevel(const SbdDirectIp::MtMessage& message);
+    ///
+    /// Сообщить итог отправки сообщения.
+    ///
+    /// @param [in] counted Сообщение учтено в m_pending и освобождает место.
+    ///
+    void complete(Outgoing& job, TransmitReport::EOutcome outcome,
+                  bool counted = true);
+    ///
+    /// Выбрать следующее сообщение для отправки в m_sending.
+    ///
+    /// @return false, если сообщений, готовых к отправке, нет.
+    ///
+    /// Сообщения устройств, находящихся в задержке или превысивших темп,
+    /// откладываются.
+    ///
+    bool nextMessage();
+    ///
+    /// Вернуть в очередь сообщения устройств, задержка которых истекла.
+    ///
+    /// Удаляет устройства и ограничители темпа, вернувшиеся в исходное
+    /// состояние.
+    ///
+    void releaseDevices();
+    ///
+    /// Отложить сообщение и увеличить задержку его устройства.
+    ///
+    void deferDevice(Outgoing& job, int16_t status);
+    ///
+    /// Сбросить задержку устройства после успешной отправки.
+    ///
+    /// @param [in] imei IMEI устройства.
+    /// @param [in] queuePosition Позиция сообщения в очереди устройства на
+    ///                           шлюзе.
+    ///
+    /// Если очередь достигла порога, сообщения устройства придерживаются.
+    ///
+    void resetDevice(const std::string& imei, uint16_t queuePosition);
+    ERetryPolicy retryPolicy(int16_t status);
+    ///
+    /// Завершить текущий этап сессии и начать следующий.
+    ///
+    /// @param [out] elapsed Длительность завершенного этапа, если не нулевой
+    ///                      указатель.
+    /// @param [in] limit Предельная длительность нового этапа.
+    ///
+    /// По истечении предела операции ввода/вывода этапа прерываются,
+    /// автомат переходит в состояние eError.
+    ///
+    void nextPhase(Clock::duration* elapsed, std::chrono::milliseconds limit);
+    ///
+    /// Начать установку запасного соединения со шлюзом текущей сессии.
+    ///
+    void prewarm();
+    ///
+    /// Запустить предел этапа установки запасного соединения.
+    ///
+    /// Вызывается под захваченным m_spareMutex.
+    ///
+    void spareDeadline(unsigned long attempt, std::chrono::milliseconds limit);
+    ///
+    /// Использовать запасное соединение в текущей сессии.
+    ///
+    /// @return false, если подходящего запасного соединения нет.
+    ///
+    bool takeSpare();
+    void dropSpare();
+    ///
+    /// Прервать ввод/вывод сессии и запасного соединения.
+    ///
+    /// Вызывается в цикле ввода/вывода: соединители и сокеты изменяются
+    /// только в нем.
+    ///
+    void cancelIo();
+    ///
+    /// Восстановить неподтвержденные сообщения из журнала исходящих.
+    ///
+    void recoverOutbox();
+    void commitOutbox();
+    ///
+    /// Запланировать очередной групповой сброс журнала исходящих.
+    ///
+    void scheduleCommit();
 
     boost::asio::io_service& m_service;
     std::shared_ptr<boost::asio::io_service::work> m_sentinel;
     boost::asio::steady_timer m_delayTimer;
-    std::string m_host, m_port;
+    boost::asio::steady_timer m_deadlineTimer; ///< Предел длительности этапа.
+    Timeouts m_timeouts;
+    Clock::time_point m_phaseStart; ///< Начало текущего этапа сессии.
+    unsigned long m_session; ///< Номер сессии, отличает устаревшие
+                             ///< срабатывания m_deadlineTimer.
+    std::shared_ptr<GatewayPool> m_gateways;
+    size_t m_gateway; ///< Шлюз текущей сессии.
+    size_t m_failedGateway; ///< Шлюз последней неудачной сессии.
+    std::string m_host, m_port; ///< Адрес шлюза текущей сессии.
     boost::asio::ip::tcp::socket m_socket;
     boost::asio::ip::tcp::resolver m_resolver;
     boost::asio::ip::tcp::resolver::iterator m_rIterator;
+    std::shared_ptr<TcpConnector> m_connector;
+    std::chrono::milliseconds m_connectStagger;
+    boost::asio::ip::tcp::resolver m_spareResolver;
+    boost::asio::steady_timer m_spareTimer; ///< Предел этапа установки
+                                            ///< запасного соединения.
+    std::shared_ptr<TcpConnector> m_spareConnector;
+    TcpConnector::SocketPtr m_spare; ///< Запасное соединение.
+    size_t m_spareGateway; ///< Шлюз запасного соединения.
+    Clock::time_point m_spareStamp; ///< Время установки запасного соединения.
+    std::chrono::milliseconds m_spareMaxIdle;
+    bool m_warming; ///< Устанавливается запасное соединение.
+    unsigned long m_spareAttempt; ///< Номер попытки, отличает устаревшие
+                                  ///< обработчики.
+    std::mutex m_spareMutex; ///< Защищает запасное соединение: оно
+                             ///< устанавливается в цикле ввода/вывода, а
+                             ///< забирается в потоке передатчика.
+    bool m_prewarmed; ///< Текущая сессия использует запасное соединение.
     bool m_running, m_shutdown;
     unsigned short int m_errDelay;
     std::shared_ptr<std::thread> m_thread;
-    JobUnitQueue<SbdDirectIp::MtMessage> m_messageQueue;
+    PriorityJobQueue<Outgoing> m_messageQueue;
+    std::shared_ptr<QueueStats> m_queueStats;
     State m_prevState, m_state;
-    SbdDirectIp::MtMessage m_sendingMessage;
+    std::mutex m_stateMutex;
+    std::condition_variable m_stateCond; ///< Сигнал о завершении сессии.
+    Outgoing m_sending; ///< Отправляемое сообщение.
+    std::map<std::string, Device> m_devices; ///< Устройства с ошибками
+                                             ///< доставки, по IMEI.
+    std::map<int16_t, ERetryPolicy> m_retryPolicies;
+    std::chrono::milliseconds m_deviceMinDelay, m_deviceMaxDelay;
+    uint16_t m_gatewayQueueLimit;
+    std::chrono::milliseconds m_gatewayQueueTimeout;
+    TokenBucket m_rateLimit; ///< Общий темп сессий.
+    double m_deviceRate, m_deviceBurst;
+    std::map<std::string, TokenBucket> m_deviceRateLimits; ///< Темп сессий
+                                                           ///< по IMEI.
+    mutable std::mutex m_devicesMutex; ///< Мутекс устройств, политик и
+                                       ///< ограничителей темпа.
+    size_t m_capacity; ///< Ограничение количества сообщений, 0 -- нет.
+    EOverflowPolicy m_overflowPolicy;
+    size_t m_pending; ///< Сообщения, принятые и не получившие итог.
+    size_t m_highWaterMark;
+    mutable std::mutex m_capacityMutex;
+    std::condition_variable m_capacityCond; ///< Сигнал об освобождении места.
+    std::shared_ptr<MtOutbox> m_outbox; ///< Журнал исходящих.
+    bool m_outboxRecovered;
+    boost::asio::steady_timer m_commitTimer; ///< Период сброса журнала.
+    std::mutex m_commitMutex; ///< Защищает m_commitTimer.
     std::shared_ptr<boost::asio::streambuf> m_buf;
     SbdDirectIp::ContentLength m_confirmationLength;
     SignalOnError m_emitOnError; ///< Сигнал о возникшей ошибке передачи.
     SignalOnTransmitResult m_emitOnTransmitResult; ///< Сигнал со статусом передачи.
+    SignalOnTransmitReport m_emitOnTransmitReport; ///< Сигнал с итогом отправки.
 }; // class SbdTransmitter
 
 }  // namespace Iridium
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace Iridium {
+
+///
+/// Установка TCP-соединения с параллельным перебором адресов.
+///
+/// Вместо последовательного перебора адресов (boost::asio::async_connect)
+/// попытки соединения запускаются со смещением во времени ("happy
+/// eyeballs", RFC 8305): очередная попытка начинается, если предыдущая не
+/// завершилась за интервал смещения или завершилась ошибкой. Первое
+/// установленное соединение передается обработчику, остальные попытки
+/// прерываются. Адреса IPv6 и IPv4 чередуются, начиная с первого адреса,
+/// полученного от DNS.
+///
+/// Объект создается методом create() и существует, пока не завершены
+/// его операции.
+///
+class TcpConnector:
+  public std::enable_shared_from_this<TcpConnector>,
+  private boost::noncopyable
+{
+  public:
+    typedef std::shared_ptr<boost::asio::ip::tcp::socket> SocketPtr;
+    ///
+    /// Обработчик завершения.
+    ///
+    /// Вызывается ровно один раз: с установленным соединением либо с
+    /// ошибкой последней неудачной попытки (boost::asio::error::
+    /// operation_aborted после cancel()).
+    ///
+    typedef std::function<void (const boost::system::error_code&, SocketPtr)> Handler;
+
+    static const std::chrono::milliseconds DefaultStagger;
+
+    static std::shared_ptr<TcpConnector> create(boost::asio::io_service& service);
+
+    ///
+    /// Начать установку соединения.
+    ///
+    /// @param [in] endpoints Результат разрешения имени.
+    /// @param [in] stagger Интервал смещения попыток.
+    /// @param [in] handler Обработчик завершения, вызывается в цикле
+    ///                     ввода/вывода.
+    ///
+    void connect(boost::asio::ip::tcp::resolver::iterator endpoints,
+                 std::chrono::milliseconds const& stagger,
+                 const Handler& handler);
+    ///
+    /// Прервать установку соединения.
+    ///
+    void cancel();
+
+  private:
+    TcpConnector(boost::asio::io_service& service);
+
+    void attempt();
+    void finish(const boost::system::error_code& ec, SocketPtr socket);
+
+    boost::asio::io_service& m_service;
+    boost::asio::steady_timer m_staggerTimer;
+    std::chrono::milliseconds m_stagger;
+    std::vector<boost::asio::ip::tcp::endpoint> m_endpoints;
+    size_t m_next; ///< Следующий адрес для попытки.
+    size_t m_active; ///< Незавершенные попытки.
+    std::vector<SocketPtr> m_sockets; ///< Сокеты попыток.
+    boost::system::error_code m_lastError;
+    Handler m_handler; ///< Пуст после вызова.
+}; // class TcpConnector
+
+} // namespace Iridium
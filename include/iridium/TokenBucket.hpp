@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace Iridium {
+
+///
+/// Ограничитель темпа "ведро с маркерами" (token bucket).
+///
+/// Ведро пополняется маркерами с постоянной скоростью до заданной емкости
+/// (допустимого всплеска). Каждое событие расходует один маркер; если
+/// маркеров нет, событие должно ждать пополнения. Так средний темп не
+/// превышает скорости пополнения, а кратковременно допускается всплеск
+/// не более емкости ведра.
+///
+/// Класс не потокобезопасен.
+///
+class TokenBucket
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    ///
+    /// @param [in] rate Скорость пополнения, маркеров в секунду; 0 --
+    ///                  темп не ограничен.
+    /// @param [in] burst Емкость ведра, не менее одного маркера.
+    ///
+    TokenBucket(double rate = 0, double burst = 1):
+      m_rate(0), m_burst(1), m_tokens(1), m_stamp(Clock::now())
+    {
+      configure(rate, burst);
+      m_tokens = m_burst;
+    }
+
+    ///
+    /// Изменить параметры ограничителя.
+    ///
+    /// Накопленные маркеры сохраняются в пределах новой емкости.
+    ///
+    inline void configure(double rate, double burst)
+    {
+      refill(Clock::now());
+      m_rate = (rate > 0) ? rate : 0;
+      m_burst = (burst >= 1) ? burst : 1;
+      m_tokens = std::min(m_tokens, m_burst);
+    }
+
+    inline bool unlimited() const { return m_rate == 0; }
+
+    ///
+    /// Время до появления маркера.
+    ///
+    /// @return Нулевая длительность, если маркер есть.
+    ///
+    inline Clock::duration delay(Clock::time_point now)
+    {
+      if (unlimited()) return Clock::duration(0);
+      refill(now);
+      if (m_tokens >= 1) return Clock::duration(0);
+      return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((1 - m_tokens) / m_rate)
+      ) + Clock::duration(1);
+    }
+
+    ///
+    /// Израсходовать маркер.
+    ///
+    /// @return false, если маркера нет.
+    ///
+    inline bool consume(Clock::time_point now)
+    {
+      if (unlimited()) return true;
+      refill(now);
+      if (m_tokens < 1) return false;
+      m_tokens -= 1;
+      return true;
+    }
+
+    ///
+    /// Ведро заполнено полностью, т.е. ограничитель находится в исходном
+    /// состоянии.
+    ///
+    inline bool full(Clock::time_point now)
+    {
+      if (unlimited()) return true;
+      refill(now);
+      return m_tokens >= m_burst;
+    }
+
+  private:
+    inline void refill(Clock::time_point now)
+    {
+      if (now <= m_stamp) return;
+      std::chrono::duration<double> elapsed = now - m_stamp;
+      m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+      m_stamp = now;
+    }
+
+    double m_rate; ///< Маркеров в секунду.
+    double m_burst; ///< Емкость ведра.
+    double m_tokens; ///< Текущее количество маркеров.
+    Clock::time_point m_stamp; ///< Время последнего пополнения.
+}; // class TokenBucket
+
+} // namespace Iridium
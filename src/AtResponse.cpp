@@ -0,0 +1,154 @@
+#include <cstring>
+#include <limits>
+#include "iridium/AtResponse.hpp"
+
+using namespace Iridium;
+
+namespace {
+
+const char ErrorResult[] = "ERROR\r\n";
+const size_t ErrorResultLength = sizeof(ErrorResult) - 1;
+
+inline bool isBlank(char c)
+{
+  return (c == ' ') || (c == '\r');
+}
+
+///
+/// Совпадение образца с данными, начиная с позиции.
+///
+/// @return Длина совпадения: длина образца -- полное, меньше -- данные
+///         закончились раньше образца, 0 -- несовпадение.
+///
+size_t match(const char* data, const char* end, const char* pattern,
+             size_t length)
+{
+  size_t i = 0;
+  while ((i < length) && (data + i < end) && (data[i] == pattern[i])) i++;
+  if ((i < length) && (data + i < end)) return 0;
+  return i;
+}
+
+}
+
+bool AtResponse::findEnd(const char* data, size_t size, const char* expected,
+                         size_t& length)
+{
+  const char* end = data + size;
+  size_t expectedLength = std::strlen(expected);
+  for (const char* p = data; p < end; p++)
+  {
+    if (match(p, end, expected, expectedLength) == expectedLength)
+    {
+      length = p - data + expectedLength;
+      return true;
+    }
+    if (match(p, end, ErrorResult, ErrorResultLength) == ErrorResultLength)
+    {
+      length = p - data + ErrorResultLength;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AtResponse::parseFields(const char* begin, const char* end,
+                             int32_t* values, size_t max, size_t& count)
+{
+  enum
+  {
+    eBefore, ///< Пробелы перед числом.
+    eSign, ///< Получен знак.
+    eDigits, ///< Цифры числа.
+    eAfter ///< Пробелы после числа.
+  } state = eBefore;
+  const int64_t limit = std::numeric_limits<int32_t>::max();
+  int64_t value = 0;
+  bool negative = false;
+  count = 0;
+  for (const char* p = begin; p <= end; p++)
+  {
+    char c = (p < end) ? *p : ',';
+    if (isBlank(c))
+    {
+      if (state == eDigits) state = eAfter;
+        else if (state == eSign) return false;
+      continue;
+    }
+    if (c == ',')
+    {
+      if ((state != eDigits) && (state != eAfter)) return false;
+      if (count == max) return false;
+      values[count++] = int32_t(negative ? -value : value);
+      state = eBefore;
+      value = 0;
+      negative = false;
+      continue;
+    }
+    if ((c == '-') || (c == '+'))
+    {
+      if (state != eBefore) return false;
+      negative = (c == '-');
+      state = eSign;
+      continue;
+    }
+    if ((c < '0') || (c > '9') || (state == eAfter)) return false;
+    value = value * 10 + (c - '0');
+    if (value > limit + (negative ? 1 : 0)) return false;
+    state = eDigits;
+  }
+  return true;
+}
+
+bool AtResponse::isError() const
+{
+  return (m_size >= ErrorResultLength) &&
+         (std::memcmp(m_data + m_size - ErrorResultLength, ErrorResult,
+                      ErrorResultLength) == 0);
+}
+
+bool AtResponse::line(const char* prefix, const char*& begin,
+                      const char*& end) const
+{
+  size_t prefixLength = std::strlen(prefix);
+  const char* p = m_data;
+  const char* last = m_data + m_size;
+  while (p < last)
+  {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', last - p));
+    if (!eol) eol = last;
+    const char* b = p;
+    const char* e = eol;
+    p = eol + 1;
+    while ((b < e) && isBlank(*b)) b++;
+    while ((e > b) && isBlank(*(e - 1))) e--;
+    size_t length = e - b;
+    if (!length) continue;
+    if ((length >= 2) && (b[0] == 'A') && (b[1] == 'T')) continue;
+    if ((length == 2) && (b[0] == 'O') && (b[1] == 'K')) continue;
+    if ((length < prefixLength) ||
+        (std::memcmp(b, prefix, prefixLength) != 0)) continue;
+    begin = b + prefixLength;
+    end = e;
+    return true;
+  }
+  return false;
+}
+
+bool AtResponse::fields(const char* prefix, int32_t* values, size_t max,
+                        size_t& count) const
+{
+  const char* begin;
+  const char* end;
+  count = 0;
+  return line(prefix, begin, end) &&
+         parseFields(begin, end, values, max, count);
+}
+
+bool AtResponse::resultCode(int32_t& code) const
+{
+  const char* begin;
+  const char* end;
+  size_t count;
+  return line("", begin, end) && parseFields(begin, end, &code, 1, count);
+}
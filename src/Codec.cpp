@@ -175,6 +175,55 @@ void Codec::parse(const char* payload, size_t size, MoMessage& out)
   // MO messages without location is valid
 }
 
+void Codec::parse(const char* payload, size_t size, MtMessage& out)
+{
+  const char* currPos = payload;
+  out.m_elements.clear();
+  out.m_header = out.m_payload = out.m_priority = out.m_elements.end();
+  while (currPos < payload + size)
+  {
+    uint8_t id = static_cast<uint8_t>(*currPos);
+    currPos++;
+    auto element = Codec::IEFactory(id);
+    if (!element || !InformationElement::IsMtElem(id) ||
+        InformationElement::IsMtConfirm(id))
+    {
+      out.m_elements.clear();
+      out.m_header = out.m_payload = out.m_priority = out.m_elements.end();
+      throw std::runtime_error("unknown information element");
+    }
+    ContentLength offset = element->unpack(currPos, size - (currPos - payload));
+    if (!offset)
+    {
+      out.m_elements.clear();
+      out.m_header = out.m_payload = out.m_priority = out.m_elements.end();
+      throw std::runtime_error("information element parse error");
+    }
+    out.m_elements.push_back(element);
+    currPos += offset;
+  }
+  out.m_header = std::find_if(out.m_elements.begin(), out.m_elements.end(),
+                              [](const std::shared_ptr<InformationElement>& e) {
+    return e->getId() == InformationElement::eMtHeader;
+  });
+  out.m_payload = std::find_if(out.m_elements.begin(), out.m_elements.end(),
+                               [](const std::shared_ptr<InformationElement>& e) {
+    return e->getId() == InformationElement::eMtPayload;
+  });
+  out.m_priority = std::find_if(out.m_elements.begin(), out.m_elements.end(),
+                                [](const std::shared_ptr<InformationElement>& e) {
+    return e->getId() == InformationElement::eMtMsgPriority;
+  });
+  if (out.m_header == out.m_elements.end())
+  {
+    out.m_elements.clear();
+    out.m_payload = out.m_priority = out.m_elements.end();
+    throw std::runtime_error("no header found");
+  }
+  // MT messages without payload (ring alert, flush queue) and priority is
+  // valid
+}
+
 void Codec::parse(const char* payload, size_t size, MtConfirmMessage& out)
 {
   const char* currPos = payload;
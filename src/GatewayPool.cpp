@@ -0,0 +1,144 @@
+#include <limits>
+#include <stdexcept>
+#include "iridium/GatewayPool.hpp"
+
+using namespace Iridium;
+
+const size_t GatewayPool::None = std::numeric_limits<size_t>::max();
+const unsigned int GatewayPool::DefaultFailureThreshold = 3;
+const std::chrono::milliseconds GatewayPool::DefaultOpenInterval(30000);
+
+GatewayPool::GatewayPool():
+  m_threshold(DefaultFailureThreshold),
+  m_interval(DefaultOpenInterval)
+{
+}
+
+size_t GatewayPool::add(const Gateway& gateway)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_gateways.push_back(Entry(gateway));
+  return m_gateways.size() - 1;
+}
+
+void GatewayPool::setBreaker(unsigned int threshold,
+                             std::chrono::milliseconds const& interval)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_threshold = threshold ? threshold : 1;
+  m_interval = interval;
+}
+
+bool GatewayPool::ready(const Entry& entry, Clock::time_point now) const
+{
+  // пробная сессия, не сообщившая итог, не блокирует шлюз навсегда
+  return (entry.status.state == eClosed) || (entry.until <= now);
+}
+
+size_t GatewayPool::select(size_t avoid)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  Clock::time_point now = Clock::now();
+  bool others = false;
+  for (size_t i = 0; i < m_gateways.size(); i++)
+    if ((i != avoid) && ready(m_gateways[i], now)) others = true;
+  if (!others) avoid = None;
+  // наивысший уровень предпочтения среди доступных шлюзов
+  size_t selected = None;
+  for (size_t i = 0; i < m_gateways.size(); i++)
+  {
+    if ((i == avoid) || !ready(m_gateways[i], now)) continue;
+    if ((selected == None) ||
+        (m_gateways[i].status.gateway.preference <
+         m_gateways[selected].status.gateway.preference))
+      selected = i;
+  }
+  if (selected == None) return None;
+  unsigned int preference = m_gateways[selected].status.gateway.preference;
+  // плавный взвешенный циклический выбор
+  long total = 0;
+  selected = None;
+  for (size_t i = 0; i < m_gateways.size(); i++)
+  {
+    Entry& entry = m_gateways[i];
+    if ((i == avoid) || !ready(entry, now) ||
+        (entry.status.gateway.preference != preference))
+      continue;
+    entry.current += entry.status.gateway.weight;
+    total += entry.status.gateway.weight;
+    if ((selected == None) || (entry.current > m_gateways[selected].current))
+      selected = i;
+  }
+  Entry& entry = m_gateways[selected];
+  entry.current -= total;
+  if (entry.status.state != eClosed)
+  {
+    entry.status.state = eHalfOpen;
+    entry.until = now + m_interval;
+  }
+  return selected;
+}
+
+bool GatewayPool::available(size_t except) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  Clock::time_point now = Clock::now();
+  for (size_t i = 0; i < m_gateways.size(); i++)
+    if ((i != except) && ready(m_gateways[i], now)) return true;
+  return false;
+}
+
+void GatewayPool::success(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  if (index >= m_gateways.size()) return;
+  Status& status = m_gateways[index].status;
+  status.state = eClosed;
+  status.failures = 0;
+  status.successes++;
+}
+
+void GatewayPool::failure(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  if (index >= m_gateways.size()) return;
+  Entry& entry = m_gateways[index];
+  entry.status.failures++;
+  entry.status.errors++;
+  if ((entry.status.state == eHalfOpen) ||
+      (entry.status.failures >= m_threshold))
+  {
+    entry.status.state = eOpen;
+    entry.until = Clock::now() + m_interval;
+  }
+}
+
+GatewayPool::Gateway GatewayPool::gateway(size_t index) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_gateways.at(index).status.gateway;
+}
+
+size_t GatewayPool::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_gateways.size();
+}
+
+std::vector<GatewayPool::Status> GatewayPool::status() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  std::vector<Status> out;
+  out.reserve(m_gateways.size());
+  for (auto& entry: m_gateways) out.push_back(entry.status);
+  return out;
+}
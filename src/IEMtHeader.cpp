@@ -19,9 +19,10 @@ ContentLength IEMtHeader::unpack(const char* data, ContentLength size)
   std::memset(m_content.m_imei.value, 0, sizeof(m_content.m_imei));
   std::memcpy(m_content.m_imei.value, data + offset, sizeof(m_content.m_imei) - 1);
   offset += sizeof(m_content.m_imei) - 1;
-  std::memcpy(&m_content.m_dispositionFlags, data + offset,
-              sizeof(m_content.m_dispositionFlags));
-  offset += sizeof(m_content.m_dispositionFlags);
+  uint16_t buf16 = 0;
+  std::memcpy(&buf16, data + offset, sizeof(buf16));
+  m_content.m_dispositionFlags.set(ntohs(buf16));
+  offset += sizeof(buf16);
   return offset;
 }
 
@@ -10,6 +10,20 @@
 #include "iridium/IEMtConfirmationMsg.hpp"
 #include "iridium/Message.hpp"
 
+namespace {
+
+///
+/// Move iterator from one elements vector to the same position in another.
+///
+template <class Vector> typename Vector::iterator rebind(
+  const Vector& from, typename Vector::const_iterator it, Vector& to
+)
+{
+  return to.begin() + (it - from.begin());
+}
+
+}
+
 namespace Iridium {
 namespace SbdDirectIp {
 
@@ -25,6 +39,23 @@ MoMessage::MoMessage():
 {
 }
 
+MoMessage::MoMessage(const MoMessage& other): Message(other)
+{
+  m_header = rebind(other.m_elements, other.m_header, m_elements);
+  m_payload = rebind(other.m_elements, other.m_payload, m_elements);
+  m_location = rebind(other.m_elements, other.m_location, m_elements);
+}
+
+MoMessage& MoMessage::operator=(const MoMessage& other)
+{
+  if (this == &other) return *this;
+  m_elements = other.m_elements;
+  m_header = rebind(other.m_elements, other.m_header, m_elements);
+  m_payload = rebind(other.m_elements, other.m_payload, m_elements);
+  m_location = rebind(other.m_elements, other.m_location, m_elements);
+  return *this;
+}
+
 std::string MoMessage::imei() const
 {
   if (m_header == m_elements.end())
@@ -59,6 +90,23 @@ MtMessage::MtMessage():
 {
 }
 
+MtMessage::MtMessage(const MtMessage& other): Message(other)
+{
+  m_header = rebind(other.m_elements, other.m_header, m_elements);
+  m_payload = rebind(other.m_elements, other.m_payload, m_elements);
+  m_priority = rebind(other.m_elements, other.m_priority, m_elements);
+}
+
+MtMessage& MtMessage::operator=(const MtMessage& other)
+{
+  if (this == &other) return *this;
+  m_elements = other.m_elements;
+  m_header = rebind(other.m_elements, other.m_header, m_elements);
+  m_payload = rebind(other.m_elements, other.m_payload, m_elements);
+  m_priority = rebind(other.m_elements, other.m_priority, m_elements);
+  return *this;
+}
+
 std::string MtMessage::imei() const
 {
   if (m_header == m_elements.end())
@@ -81,6 +129,39 @@ std::vector<char> MtMessage::payload() const
     }
 }
 
+uint32_t MtMessage::messageId() const
+{
+  if (m_header == m_elements.end())
+    return 0;
+    else
+    {
+      IEMtHeader* h = static_cast<IEMtHeader*>(m_header->get());
+      return h->getContent().m_uniqueClientMsgId;
+    }
+}
+
+uint16_t MtMessage::priority() const
+{
+  if (m_priority == m_elements.end())
+    return IEMtPriority::MinPriority;
+    else
+    {
+      IEMtPriority* p = static_cast<IEMtPriority*>(m_priority->get());
+      return p->getContent().m_priority;
+    }
+}
+
+MtMessageFlags MtMessage::flags() const
+{
+  if (m_header == m_elements.end())
+    return MtMessageFlags();
+    else
+    {
+      IEMtHeader* h = static_cast<IEMtHeader*>(m_header->get());
+      return h->getContent().m_dispositionFlags;
+    }
+}
+
 std::vector<char> MtMessage::serialize()
 {
   MessageHeader header = { SbdProtoNumber, 0 };
@@ -104,6 +185,20 @@ MtConfirmMessage::MtConfirmMessage(): m_confirmation(m_elements.end())
 {
 }
 
+MtConfirmMessage::MtConfirmMessage(const MtConfirmMessage& other):
+  m_elements(other.m_elements)
+{
+  m_confirmation = rebind(other.m_elements, other.m_confirmation, m_elements);
+}
+
+MtConfirmMessage& MtConfirmMessage::operator=(const MtConfirmMessage& other)
+{
+  if (this == &other) return *this;
+  m_elements = other.m_elements;
+  m_confirmation = rebind(other.m_elements, other.m_confirmation, m_elements);
+  return *this;
+}
+
 std::string MtConfirmMessage::imei() const
 {
   if (m_confirmation == m_elements.end())
@@ -0,0 +1,257 @@
+#include <stdexcept>
+#include "iridium/IEMoPayload.hpp" // max payload size
+#include "iridium/MoOutbox.hpp"
+
+namespace {
+
+// MO status AT+SBDIX, Iridium ISU AT Command Reference
+const uint8_t AccessDenied = 15;
+const uint8_t IsuLocked = 16;
+const uint8_t TryLaterRegistration = 36;
+const uint8_t TryLaterTraffic = 38;
+
+}
+
+using namespace Iridium;
+
+const unsigned int MoOutbox::DefaultQuickRetries = 3;
+const std::chrono::milliseconds MoOutbox::DefaultQuickDelay(5000);
+const std::chrono::milliseconds MoOutbox::DefaultMinDelay(30000);
+const std::chrono::milliseconds MoOutbox::DefaultMaxDelay(30 * 60 * 1000);
+const std::chrono::milliseconds MoOutbox::DefaultPollInterval(10000);
+const std::chrono::milliseconds MoOutbox::TryLaterDelay(3 * 60 * 1000);
+
+MoOutbox::MoOutbox(boost::asio::io_service& service, Modem& modem):
+  m_service(service),
+  m_modem(modem),
+  m_timer(service),
+  m_quickRetries(DefaultQuickRetries),
+  m_quickDelay(DefaultQuickDelay),
+  m_minDelay(DefaultMinDelay),
+  m_maxDelay(DefaultMaxDelay),
+  m_pollInterval(DefaultPollInterval),
+  m_minSignal(1),
+  m_random(static_cast<unsigned int>(
+    std::chrono::steady_clock::now().time_since_epoch().count()
+  )),
+  m_running(false),
+  m_active(false),
+  m_waiting(false),
+  m_failures(0),
+  m_expectedMomsn(0),
+  m_checkDelivery(false),
+  m_nextId(1)
+{
+}
+
+void MoOutbox::setQuickRetries(unsigned int count,
+                               std::chrono::milliseconds const& delay)
+{
+  m_quickRetries = count;
+  m_quickDelay = delay;
+}
+
+void MoOutbox::setBackoff(std::chrono::milliseconds const& min,
+                          std::chrono::milliseconds const& max)
+{
+  m_minDelay = min;
+  m_maxDelay = (max < min) ? min : max;
+}
+
+void MoOutbox::start()
+{
+  m_service.post([this]() {
+    if (m_running) return;
+    m_running = true;
+    kick();
+  });
+}
+
+void MoOutbox::stop()
+{
+  m_service.post([this]() {
+    m_running = false;
+    if (m_waiting)
+    {
+      m_waiting = false;
+      m_timer.cancel();
+    }
+  });
+}
+
+uint64_t MoOutbox::post(const std::vector<char>& payload)
+{
+  if (payload.empty() ||
+      (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength))
+    throw std::runtime_error("bad payload length");
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    id = m_nextId++;
+    m_queue.push_back(Entry{ id, payload, 0 });
+  }
+  m_service.post([this]() { kick(); });
+  return id;
+}
+
+size_t MoOutbox::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_queue.size();
+}
+
+void MoOutbox::kick()
+{
+  if (!m_running || m_active || m_waiting) return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    if (m_queue.empty()) return;
+  }
+  m_active = true;
+  m_modem.async_sbd_get_status([this](const boost::system::error_code& ec,
+                                      const Modem::SbdStatus& status) {
+    onSbdStatus(ec, status);
+  });
+}
+
+void MoOutbox::onSbdStatus(const boost::system::error_code& ec,
+                           const Modem::SbdStatus& status)
+{
+  if (ec)
+  {
+    retry(0);
+    return;
+  }
+  if (m_checkDelivery)
+  {
+    // MOMSN увеличивается только успешным сеансом
+    m_checkDelivery = false;
+    if (status.momsn != m_expectedMomsn)
+    {
+      delivered(m_expectedMomsn, true);
+      return;
+    }
+  }
+  m_expectedMomsn = status.momsn;
+  if (!m_running)
+  {
+    m_active = false;
+    return;
+  }
+  if (m_modem.serviceAvailable() == 0)
+  {
+    wait(m_pollInterval);
+    return;
+  }
+  int quality = m_modem.signalQuality();
+  if (quality < 0)
+  {
+    m_modem.async_get_signal_quality(false, [this](const boost::system::error_code& ec,
+                                                   uint8_t quality) {
+      onSignal(ec, quality);
+    });
+    return;
+  }
+  onSignal(boost::system::error_code(), uint8_t(quality));
+}
+
+void MoOutbox::onSignal(const boost::system::error_code& ec, uint8_t quality)
+{
+  if (ec) retry(0);
+    else if (!m_running) m_active = false;
+    else if (quality < m_minSignal) wait(m_pollInterval);
+    else exchange();
+}
+
+void MoOutbox::exchange()
+{
+  std::vector<char> payload;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    Entry& entry = m_queue.front();
+    entry.attempts++;
+    payload = entry.payload;
+  }
+  m_modem.async_exchange(payload, [this](const boost::system::error_code& ec,
+                                         const Modem::ExchangeResult& result) {
+    onExchange(ec, result);
+  });
+}
+
+void MoOutbox::onExchange(const boost::system::error_code& ec,
+                          const Modem::ExchangeResult& result)
+{
+  if (m_mtCallback)
+    for (auto& message: result.mt) m_mtCallback(message);
+  if (ec)
+  {
+    // сообщение могло уйти: проверяется по MOMSN перед следующей попыткой
+    if (!result.write_status) m_checkDelivery = true;
+    retry(0);
+    return;
+  }
+  // MO status 0-4 -- сообщение передано
+  if (result.session.mo_status <= 4) delivered(result.session.momsn, false);
+    else retry(result.session.mo_status);
+}
+
+void MoOutbox::delivered(uint16_t momsn, bool inferred)
+{
+  Delivery delivery;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    const Entry& entry = m_queue.front();
+    delivery.id = entry.id;
+    delivery.attempts = entry.attempts;
+    m_queue.pop_front();
+  }
+  delivery.momsn = momsn;
+  delivery.inferred = inferred;
+  m_failures = 0;
+  m_active = false;
+  if (m_deliveryCallback) m_deliveryCallback(delivery);
+  kick();
+}
+
+void MoOutbox::retry(uint8_t moStatus)
+{
+  m_failures++;
+  std::chrono::milliseconds delay(m_quickDelay);
+  if (m_failures > m_quickRetries)
+  {
+    delay = m_minDelay;
+    for (unsigned int i = m_failures - m_quickRetries - 1;
+         i && (delay < m_maxDelay); i--)
+      delay *= 2;
+    if (delay > m_maxDelay) delay = m_maxDelay;
+  }
+  // повторы не помогут, пока шлюз не снимет запрет
+  if ((moStatus == AccessDenied) || (moStatus == IsuLocked)) delay = m_maxDelay;
+  if (delay.count() > 0)
+  {
+    std::uniform_int_distribution<int64_t> jitter(0, delay.count() / 4);
+    delay += std::chrono::milliseconds(jitter(m_random));
+  }
+  if (((moStatus == TryLaterRegistration) || (moStatus == TryLaterTraffic)) &&
+      (delay < TryLaterDelay))
+    delay = TryLaterDelay;
+  wait(delay);
+}
+
+void MoOutbox::wait(std::chrono::milliseconds const& delay)
+{
+  m_active = false;
+  if (!m_running) return;
+  m_waiting = true;
+  m_timer.expires_from_now(delay);
+  m_timer.async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) return;
+    m_waiting = false;
+    kick();
+  });
+}
@@ -0,0 +1,137 @@
+#include <stdexcept>
+#include "iridium/IEMoPayload.hpp"
+#include "iridium/MoPacker.hpp"
+#include "iridium/PayloadFraming.hpp"
+
+using namespace Iridium;
+
+const size_t MoPacker::DefaultPayloadLimit = 340;
+const std::chrono::milliseconds MoPacker::DefaultHoldTime(10000);
+
+MoPacker::MoPacker(boost::asio::io_service& service, MoOutbox& outbox,
+                   size_t limit, std::chrono::milliseconds const& holdTime):
+  m_service(service),
+  m_outbox(outbox),
+  m_limit(limit),
+  m_holdTime(holdTime),
+  m_records(0)
+{
+  if ((limit <= PayloadFraming::HeaderSize) ||
+      (limit > size_t(SbdDirectIp::IEMoPayload::MaxPayloadLength)))
+    throw std::runtime_error("bad MO payload limit");
+}
+
+MoPacker::~MoPacker()
+{
+  // сработавший таймер больше не обращается к объекту, пакет отправляется
+  // здесь
+  m_guard.close();
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+    // ignore outbox errors
+  }
+}
+
+void MoPacker::setHoldTime(std::chrono::milliseconds const& holdTime)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_holdTime = holdTime;
+}
+
+void MoPacker::post(const char* data, size_t size)
+{
+  if (PayloadFraming::framedSize(size) > m_limit)
+    throw std::runtime_error("MO record too large to pack");
+  std::vector<char> full, ready;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    if (m_records &&
+        (!m_holdTime.count() ||
+         (m_payload.size() + PayloadFraming::framedSize(size) > m_limit)))
+    {
+      // запись не помещается (или удержание отключено), пакет отправляется
+      // досрочно
+      full.swap(m_payload);
+      m_records = 0;
+      m_timer->cancel();
+      m_timer.reset();
+    }
+    if (!m_holdTime.count())
+    {
+      PayloadFraming::pack(ready, data, size);
+    }
+    else
+    {
+      if (!m_timer)
+      {
+        auto timer = std::make_shared<boost::asio::steady_timer>(m_service);
+        m_timer = timer;
+        timer->expires_from_now(m_holdTime);
+        boost::asio::steady_timer* id = timer.get();
+        HandlerGuard::Weak guard = m_guard.weak();
+        timer->async_wait([this, guard, id](const boost::system::error_code& ec) {
+          if (ec == boost::asio::error::operation_aborted) return;
+          HandlerGuard::run(guard, [this, id]() {
+            std::vector<char> expired;
+            {
+              std::lock_guard<std::mutex> lock(m_mutex);
+              (void)lock;
+              // пакет уже отправлен, таймер принадлежит новому пакету
+              if (m_timer.get() != id) return;
+              expired.swap(m_payload);
+              m_records = 0;
+              m_timer.reset();
+            }
+            send(expired);
+          });
+        });
+      }
+      PayloadFraming::pack(m_payload, data, size);
+      m_records++;
+      if (m_limit - m_payload.size() <= PayloadFraming::HeaderSize)
+      {
+        // больше ни одна запись не поместится
+        ready.swap(m_payload);
+        m_records = 0;
+        m_timer->cancel();
+        m_timer.reset();
+      }
+    }
+  }
+  send(full);
+  send(ready);
+}
+
+void MoPacker::flush()
+{
+  std::vector<char> payload;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    if (!m_timer) return;
+    payload.swap(m_payload);
+    m_records = 0;
+    m_timer->cancel();
+    m_timer.reset();
+  }
+  send(payload);
+}
+
+size_t MoPacker::pending() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_records;
+}
+
+void MoPacker::send(std::vector<char>& payload)
+{
+  if (payload.empty()) return;
+  m_outbox.post(payload);
+}
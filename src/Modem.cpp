@@ -1,13 +1,12 @@
-#include <atomic>
 #include <condition_variable>
+#include <cstring>
+#include <mutex>
 #include <stdexcept>
 #include <sstream>
-#include <thread>
 #include <utility>
-#include <boost/lexical_cast.hpp>
-#include <boost/numeric/conversion/cast.hpp> 
 #include "iridium/IEMoPayload.hpp" // max payload size
 #include "iridium/Modem.hpp"
+#include "iridium/ModemReactor.hpp"
 
 namespace {
 
@@ -17,7 +16,7 @@ bool isBigEndian()
     uint32_t i;
     char c[4];
   } bint = { 0x01020304 };
-  return bint.c[0] == 1; 
+  return bint.c[0] == 1;
 }
 
 #if 0
@@ -36,15 +35,155 @@ void logBuf(boost::asio::streambuf& buf)
 }
 #endif
 
+boost::system::error_code badMessage()
+{
+  return boost::system::errc::make_error_code(boost::system::errc::bad_message);
+}
+
+///
+/// Строка -- итоговый код результата команды (OK или ERROR).
+///
+bool isFinalResult(const char* begin, const char* end)
+{
+  while ((begin < end) && std::strchr(" \r\n", *begin)) begin++;
+  while ((end > begin) && std::strchr(" \r\n", *(end - 1))) end--;
+  size_t length = end - begin;
+  return ((length == 2) && !std::memcmp(begin, "OK", 2)) ||
+         ((length == 5) && !std::memcmp(begin, "ERROR", 5));
+}
+
+///
+/// Разобрать строку +CREG: ответа.
+///
+bool parseNetStatus(const Iridium::AtResponse& response, uint8_t& status)
+{
+  int32_t fields[2];
+  size_t count;
+  if (!response.fields("+CREG:", fields, 2, count) || (count < 2) ||
+      (fields[1] < 0) || (fields[1] > 0xFF))
+    return false;
+  status = uint8_t(fields[1]);
+  return true;
+}
+
+///
+/// Разобрать строку +SBDSX: ответа.
+///
+bool parseSbdStatus(const Iridium::AtResponse& response,
+                    Iridium::Modem::SbdStatus& status)
+{
+  int32_t fields[6];
+  size_t count;
+  if (!response.fields("+SBDSX:", fields, 6, count) || (count < 6))
+    return false;
+  status.mo_flag = (fields[0] == 1);
+  status.momsn = uint16_t(fields[1]);
+  status.mt_flag = (fields[2] == 1);
+  status.mtmsn = fields[3];
+  status.ra_flag = (fields[4] == 1);
+  status.mt_queue = uint8_t(fields[5]);
+  return true;
+}
+
+///
+/// Подготовить запись MO-сообщения: команду AT+SBDWB и данные с контрольной
+/// суммой.
+///
+void prepareMessage(const std::vector<char>& payload,
+                    std::shared_ptr<std::string>& command,
+                    std::shared_ptr<std::string>& data)
+{
+  std::ostringstream cmd;
+  cmd << "AT+SBDWB=" << payload.size() << "\r";
+  command = std::make_shared<std::string>(cmd.str());
+  uint32_t sum = 0;
+  for (char c: payload) sum += c;
+  union {
+    uint16_t i;
+    char c[2];
+  } crc;
+  crc.i = sum & 0xFFFF;
+  if (!isBigEndian()) std::swap(crc.c[0], crc.c[1]);
+  data = std::make_shared<std::string>(payload.begin(), payload.end());
+  data->append(crc.c, sizeof(crc.c));
+}
+
+///
+/// Дождаться завершения асинхронной операции модема.
+///
+template <class Result> boost::system::error_code await(
+  const std::function<void (const std::function<void (const boost::system::error_code&, const Result&)>&)>& start,
+  Result& result)
+{
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool complete = false;
+  boost::system::error_code error;
+  start([&](const boost::system::error_code& ec, const Result& r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    (void)lock;
+    error = ec;
+    result = r;
+    complete = true;
+    cond.notify_one();
+  });
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [&complete]() { return complete; });
+  return error;
+}
+
 }
 
 using namespace Iridium;
 
+const uint8_t Modem::MaxExchangeSessions;
+const uint16_t Modem::ResyncQuietTime;
+
+///
+/// Состояние транзакции Exchange().
+///
+struct Modem::ExchangeState
+{
+  ExchangeResult result;
+  Completion<ExchangeResult> done; ///< Завершение операции.
+  SbdSessionStatus last; ///< Состояние последнего сеанса.
+  bool moPending; ///< MO-сообщение записано, но еще не передано.
+  bool moSent; ///< MO-сообщение передано и осталось в буфере модема.
+
+  ExchangeState(): moPending(false), moSent(false) {}
+};
+
 Modem::Modem(boost::asio::io_service& service, const std::string& device):
+  Modem(service, device, nullptr)
+{
+}
+
+Modem::Modem(boost::asio::io_service& service, const std::string& device,
+             ModemReactor& reactor):
+  Modem(service, device, &reactor)
+{
+}
+
+Modem::Modem(boost::asio::io_service& service, const std::string& device,
+             ModemReactor* reactor):
   m_service(service),
-  m_ioService(),
+  m_ownService(reactor ? nullptr : new boost::asio::io_service()),
+  m_ioService(reactor ? reactor->service() : *m_ownService),
   m_io(m_ioService),
   m_timer(m_ioService),
+  m_ioActive(false),
+  m_pending(0),
+  m_closing(false),
+  m_busy(false),
+  m_cancelled(false),
+  m_dirty(false),
+  m_rxBegin(0),
+  m_rxEnd(0),
+  m_stepSeq(0),
+  m_timedOut(false),
+  m_listening(false),
+  m_signalQuality(-1),
+  m_serviceAvailable(-1),
   m_deviceName(device)
 {
 }
@@ -68,17 +207,23 @@ void Modem::Open()
   m_io.set_option(boost::asio::serial_port_base::stop_bits(
     boost::asio::serial_port_base::stop_bits::one
   ));
+  m_closing = false;
+  m_dirty = false;
+  m_signalQuality = -1;
+  m_serviceAvailable = -1;
+  startIo();
   // Responses are sent to the DTE in verbose mode.
-  boost::asio::write(m_io, boost::asio::buffer("ATQ0V1\r", 9), ec);
-  if (ec)
-  {
-    m_io.close();
-    throw std::runtime_error(ec.message());
-  }
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
+  bool ok;
+  ec = execute<bool>("ATQ0V1\r", 5, [](const AtResponse&, bool& ok) {
+    ok = true;
+    return true;
+  }, ok);
   if (ec)
   {
+    m_closing = true;
+    // ожидание незапрошенных сообщений могло начаться
+    cancel();
+    stopIo();
     m_io.close();
     throw std::runtime_error(ec.message());
   }
@@ -90,10 +235,11 @@ void Modem::Close(bool woexcept)
 {
   try
   {
-    m_timer.cancel();
-    // waiting when read_until_timeout() complete
-    std::unique_lock<std::mutex> lock(m_mutex);
+    m_closing = true;
+    cancel();
     m_sentinel.reset();
+    // waiting when aborted operations complete
+    stopIo();
     if (isOpen()) m_io.close();
   }
   catch (...)
@@ -102,41 +248,32 @@ void Modem::Close(bool woexcept)
   }
 }
 
+void Modem::cancel()
+{
+  if (!m_ioActive) return;
+  m_ioService.post(track([this]() {
+    std::deque<Operation> pending;
+    pending.swap(m_operations);
+    for (auto& operation: pending)
+      operation.abort(boost::asio::error::operation_aborted);
+    if (!m_busy && !m_listening) return;
+    if (m_busy) m_cancelled = true;
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+    m_io.cancel(ec);
+  }));
+}
+
 bool Modem::NetGetStatus(uint8_t& status)
 {
   status = 4; // "unknown"
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+CREG?\r", 9), ec);
+  uint8_t result = status;
+  auto ec = await<uint8_t>([this](const Completion<uint8_t>& handler) {
+    startNetGetStatus(handler);
+  }, result);
   if (ec) return false;
-  // return:
-  // +CREG:002,004
-  // 
-  // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
-  if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::string::size_type pos2, pos = std::string::npos;
-  std::getline(is, line);
-  std::getline(is, line);
-  pos = line.find("+CREG:");
-  if (pos == std::string::npos) return false;
-  pos = line.find_first_of(',', pos + 6);
-  if (pos == std::string::npos) return false;
-  pos++;
-  pos2 = line.find_first_of('\r', pos);
-  try
-  {
-    status =  boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
+  status = result;
   return true;
 }
 
@@ -144,57 +281,12 @@ bool Modem::GetSignalQuality(uint8_t& quality, bool lastKnown)
 {
   quality = 0;
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(
-    m_io,
-    lastKnown ? boost::asio::buffer("AT+CSQF?\r", 9) : boost::asio::buffer("AT+CSQ?\r", 8),
-    ec
-  );
+  uint8_t result = 0;
+  auto ec = await<uint8_t>([this, lastKnown](const Completion<uint8_t>& handler) {
+    startGetSignalQuality(lastKnown, handler);
+  }, result);
   if (ec) return false;
-  // return:
-  // +CSQ:4
-  // 
-  // 000
-  // 
-  // OK
-  boost::asio::streambuf buf;
-  std::string line;
-  std::istream is(&buf);
-  std::string::size_type pos2, pos = std::string::npos;
-  if (lastKnown)
-    {
-      read_until_timeout(buf, "OK\r\n", ec, 5);
-      if (ec) return false;
-      std::getline(is, line);
-      std::getline(is, line);
-    }
-    else
-    {
-      read_until_timeout(buf, "\r\n", ec, 50);
-      if (ec) return false;
-      std::getline(is, line);
-      if (line.find("ERROR") != pos) return false;
-      read_until_timeout(buf, "\r\n", ec, 50);
-      if (ec) return false;
-      std::getline(is, line);
-      if (line.find("ERROR") != pos) return false;
-      read_until_timeout(buf, "OK\r\n", ec, 50);
-      if (ec) return false;
-    }
-  pos = line.find("+CSQ:");
-  if (pos == std::string::npos) return false;
-  pos += 5;
-  pos2 = line.find_first_of('\r', pos);
-  try
-  {
-    quality = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
+  quality = result;
   return true;
 }
 
@@ -202,168 +294,125 @@ bool Modem::SbdDetach(uint8_t& error)
 {
   error = 36; // reserved, but indicate arror
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+SBDDET\r", 10), ec);
-  if (ec) return false;
   // return:
   // +SBDDET:1,18
-  // 
+  //
   // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
+  uint8_t result = error;
+  auto ec = execute<uint8_t>("AT+SBDDET\r", 5,
+                             [](const AtResponse& response, uint8_t& result) {
+    int32_t fields[2];
+    size_t count;
+    if (!response.fields("+SBDDET:", fields, 2, count) || (count < 2) ||
+        (fields[1] < 0) || (fields[1] > 0xFF))
+      return false;
+    result = uint8_t(fields[1]);
+    return true;
+  }, result);
   if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::string::size_type pos2, pos = std::string::npos;
-  std::getline(is, line);
-  std::getline(is, line);
-  pos = line.find("+SBDDET:");
-  if (pos == std::string::npos) return false;
-  pos += 8;
-  pos = line.find_first_of(',', pos);
-  if (pos == std::string::npos) return false;
-  pos++;
-  pos2 = line.find_first_of('\r', pos);
-  try
-  {
-    error = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
+  error = result;
   return true;
 }
 
 bool Modem::SbdGetStatus(SbdStatus& status)
 {
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+SBDSX\r", 9), ec);
+  SbdStatus result;
+  auto ec = await<SbdStatus>([this](const Completion<SbdStatus>& handler) {
+    startSbdGetStatus(handler);
+  }, result);
   if (ec) return false;
-  // return:
-  // +SBDSX: 0, 13, 0, -1, 0, 0
-  // 
-  // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
+  status = result;
+  return true;
+}
+
+bool Modem::GetStatusSnapshot(StatusSnapshot& snapshot)
+{
+  if (!isOpen()) return false;
+  StatusSnapshot result;
+  auto ec = await<StatusSnapshot>([this](const Completion<StatusSnapshot>& handler) {
+    startStatusSnapshot(handler);
+  }, result);
   if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::string::size_type pos2, pos = std::string::npos;
-  std::getline(is, line);
-  std::getline(is, line);
-  pos = line.find("+SBDSX: ");
-  if (pos == std::string::npos) return false;
-  pos += 8;
-  status.mo_flag = (line[pos] == '1');
-  pos += 3;
-  pos2 = line.find_first_of(',', pos);
-  try
-  {
-    status.momsn = boost::lexical_cast<uint16_t>(line.data() + pos, pos2 - pos);
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
-  pos = pos2 + 2;
-  status.mt_flag = (line[pos] == '1');
-  pos += 3;
-  pos2 = line.find_first_of(',', pos);
-  try
-  {
-    status.mtmsn = boost::lexical_cast<int32_t>(line.data() + pos, pos2 - pos);
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
-  pos = pos2 + 2;
-  status.ra_flag = (line[pos] == '1');
-  pos += 3;
-  pos2 = line.find_first_of('\r', pos);
-  try
-  {
-    status.mt_queue = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
-  }
-  catch (boost::bad_lexical_cast& e)
-  {
-    return false;
-  }
+  snapshot = result;
   return true;
 }
 
 bool Modem::SbdClearBuffers(EClearMessageBuffers clear)
 {
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  uint8_t cmd[9] = { 'A', 'T', '+', 'S', 'B', 'D', 'D', '0', '\r' };
+  std::string cmd("AT+SBDD0\r");
   cmd[7] += clear;
-  boost::asio::write(m_io, boost::asio::buffer(cmd, sizeof(cmd)), ec);
-  if (ec) return false;
   // return:
   // 0
-  // 
+  //
   // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
-  if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::getline(is, line);
-  std::getline(is, line);
-  return (line[0] == '0');
+  int32_t code = -1;
+  auto ec = execute<int32_t>(cmd, 5, [](const AtResponse& response, int32_t& code) {
+    return response.resultCode(code);
+  }, code);
+  return !ec && (code == 0);
 }
 
 bool Modem::ClearMomsn()
 {
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+SBDC\r", 8), ec);
-  if (ec) return false;
   // return:
   // 0
-  // 
+  //
   // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
-  if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::getline(is, line);
-  std::getline(is, line);
-  return (line[0] == '0');
+  int32_t code = -1;
+  auto ec = execute<int32_t>("AT+SBDC\r", 5, [](const AtResponse& response, int32_t& code) {
+    return response.resultCode(code);
+  }, code);
+  return !ec && (code == 0);
 }
 
 bool Modem::GetImei(std::string& imei)
 {
   if (!isOpen()) return false;
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+CGSN\r", 8), ec);
-  if (ec) return false;
   // return:
   // 300125061511830
-  // 
+  //
   // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
+  std::string result;
+  auto ec = execute<std::string>("AT+CGSN\r", 5, [](const AtResponse& response, std::string& result) {
+    const char* begin;
+    const char* end;
+    if (!response.line("", begin, end)) return false;
+    result.assign(begin, end);
+    return true;
+  }, result);
   if (ec) return false;
-  std::istream is(&buf);
-  std::string line;
-  std::string::size_type pos2, pos = 0;
-  std::getline(is, line);
-  std::getline(is, line);
-  pos2 = line.find_first_of('\r', pos);
-  if (pos2 == std::string::npos) return false;
-  imei = line.substr(pos, pos2 - pos);
+  imei = result;
   return true;
 }
 
+bool Modem::SbdEnableRingAlert(bool enable)
+{
+  if (!isOpen()) return false;
+  bool ok;
+  return !execute<bool>(enable ? "AT+SBDMTA=1\r" : "AT+SBDMTA=0\r", 5,
+                        [](const AtResponse&, bool& ok) {
+    ok = true;
+    return true;
+  }, ok);
+}
+
+bool Modem::EnableIndicatorEvents(bool signal, bool service, bool antenna)
+{
+  if (!isOpen()) return false;
+  std::ostringstream cmd;
+  cmd << "AT+CIER=" << ((signal || service || antenna) ? 1 : 0) << ","
+      << (signal ? 1 : 0) << "," << (service ? 1 : 0) << ","
+      << (antenna ? 1 : 0) << "\r";
+  bool ok;
+  return !execute<bool>(cmd.str(), 5, [](const AtResponse&, bool& ok) {
+    ok = true;
+    return true;
+  }, ok);
+}
+
 uint8_t Modem::WriteMessage(const std::vector<char>& payload)
 {
   if (!isOpen())
@@ -371,244 +420,894 @@ uint8_t Modem::WriteMessage(const std::vector<char>& payload)
   if (!payload.size() ||
       (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength))
     throw std::runtime_error("bad payload length");
-  boost::system::error_code ec;
-  std::ostringstream cmd;
-  uint32_t sum = 0;
-  for (char c: payload) sum += c;
-  union {
-    uint16_t i;
-    char c[2];
-  } crc;
-  crc.i = sum & 0xFFFF;
-  if (!isBigEndian()) std::swap(crc.c[0], crc.c[1]);
-  cmd << "AT+SBDWB=" << payload.size() << "\r";
-  boost::asio::write(m_io, boost::asio::buffer(cmd.str().c_str(),
-                                               cmd.str().size()), ec);
+  uint8_t res = 4; // nonexistent return code
+  auto ec = await<uint8_t>([this, &payload](const Completion<uint8_t>& handler) {
+    startWriteMessage(payload, handler);
+  }, res);
+  if (ec == badMessage()) return 4;
+  if (ec) throw std::runtime_error(ec.message());
+  return res;
+}
+
+void Modem::ReadMessage(std::vector<char>& payload)
+{
+  payload.clear();
+  if (!isOpen())
+    throw std::runtime_error("modem not opened");
+  auto ec = await<std::vector<char> >([this](const Completion<std::vector<char> >& handler) {
+    startReadMessage(handler);
+  }, payload);
   if (ec)
-    throw std::runtime_error("send command error");
+  {
+    payload.clear();
+    throw std::runtime_error(ec.message());
+  }
+}
+
+Modem::SbdSessionStatus Modem::DoSbdSession(bool answer)
+{
+  if (!isOpen())
+    throw std::runtime_error("modem not opened");
+  SbdSessionStatus status;
+  auto ec = await<SbdSessionStatus>([this, answer](const Completion<SbdSessionStatus>& handler) {
+    startSbdSession(answer, handler);
+  }, status);
+  if (ec == badMessage()) throw std::runtime_error("bad session status");
+  if (ec) throw std::runtime_error(ec.message());
+  return status;
+}
+
+Modem::ExchangeResult Modem::Exchange(const std::vector<char>& payload)
+{
+  if (!isOpen())
+    throw std::runtime_error("modem not opened");
+  if (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength)
+    throw std::runtime_error("bad payload length");
+  ExchangeResult result;
+  auto ec = await<ExchangeResult>([this, &payload](const Completion<ExchangeResult>& handler) {
+    startExchange(payload, handler);
+  }, result);
+  if (ec && result.write_status)
+    throw std::runtime_error("message write failed");
+  if (ec == badMessage()) throw std::runtime_error("bad session status");
+  if (ec) throw std::runtime_error(ec.message());
+  return result;
+}
+
+void Modem::startNetGetStatus(const Completion<uint8_t>& handler)
+{
   // return:
-  // READY<CR><LF>
-  // hex: 52 45 41 44 59 0D 0A
+  // +CREG:002,004
+  //
+  // OK
+  startCommand("AT+CREG?\r", 5,
+               [handler](const boost::system::error_code& ec,
+                         const AtResponse& response) {
+    uint8_t status = 4;
+    if (ec) handler(ec, status);
+      else if (!parseNetStatus(response, status)) handler(badMessage(), 4);
+      else handler(ec, status);
+  });
+}
+
+void Modem::startGetSignalQuality(bool lastKnown,
+                                  const Completion<uint8_t>& handler)
+{
+  // return:
+  // +CSQ:4
+  //
+  // OK
+  //
+  // AT+CSQ waits for the signal measurement, up to 50 s.
+  const char* prefix = lastKnown ? "+CSQF:" : "+CSQ:";
+  startCommand(lastKnown ? "AT+CSQF?\r" : "AT+CSQ?\r", lastKnown ? 5 : 50,
+               [handler, prefix](const boost::system::error_code& ec,
+                                 const AtResponse& response) {
+    int32_t quality;
+    size_t count;
+    if (ec) handler(ec, 0);
+      else if (!response.fields(prefix, &quality, 1, count) || !count ||
+               (quality < 0) || (quality > 5))
+        handler(badMessage(), 0);
+      else handler(ec, uint8_t(quality));
+  });
+}
+
+void Modem::startSbdGetStatus(const Completion<SbdStatus>& handler)
+{
+  // return:
+  // +SBDSX: 0, 13, 0, -1, 0, 0
+  //
+  // OK
+  startCommand("AT+SBDSX\r", 5,
+               [handler](const boost::system::error_code& ec,
+                         const AtResponse& response) {
+    SbdStatus status;
+    if (ec) handler(ec, status);
+      else if (!parseSbdStatus(response, status))
+        handler(badMessage(), SbdStatus());
+      else handler(ec, status);
+  });
+}
+
+void Modem::startStatusSnapshot(const Completion<StatusSnapshot>& handler)
+{
+  // return:
+  // +CREG:002,001
+  // +CSQF:4
+  // +SBDSX: 0, 13, 0, -1, 0, 0
+  //
+  // OK
+  //
+  // Команды строки выполняются последовательно; при ошибке любой из них
+  // модем отвечает единственным ERROR.
+  startCommand("AT+CREG?;+CSQF;+SBDSX\r", 5,
+               [handler](const boost::system::error_code& ec,
+                         const AtResponse& response) {
+    StatusSnapshot snapshot;
+    int32_t quality;
+    size_t count;
+    if (ec)
+    {
+      handler(ec, snapshot);
+      return;
+    }
+    if (!parseNetStatus(response, snapshot.net_status) ||
+        !response.fields("+CSQF:", &quality, 1, count) || !count ||
+        (quality < 0) || (quality > 5) ||
+        !parseSbdStatus(response, snapshot.sbd))
+    {
+      handler(badMessage(), StatusSnapshot());
+      return;
+    }
+    snapshot.signal_quality = uint8_t(quality);
+    handler(ec, snapshot);
+  });
+}
+
+void Modem::startWriteMessage(const std::vector<char>& payload,
+                              const Completion<uint8_t>& handler)
+{
+  if (!payload.size() ||
+      (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength))
+  {
+    handler(boost::system::errc::make_error_code(
+      boost::system::errc::invalid_argument
+    ), 4);
+    return;
+  }
+  std::shared_ptr<std::string> command;
+  std::shared_ptr<std::string> data;
+  prepareMessage(payload, command, data);
+  submit<uint8_t>(handler, [this, command, data](const Completion<uint8_t>& done) {
+    writeMessageStep(command, data, done);
+  });
+}
+
+void Modem::startReadMessage(const Completion<std::vector<char> >& handler)
+{
+  submit<std::vector<char> >(handler, [this](const Completion<std::vector<char> >& done) {
+    readMessageStep(done);
+  });
+}
+
+void Modem::startSbdSession(bool answer,
+                            const Completion<SbdSessionStatus>& handler)
+{
+  submit<SbdSessionStatus>(handler, [this, answer](const Completion<SbdSessionStatus>& done) {
+    sessionStep(answer, done);
+  });
+}
+
+void Modem::startExchange(const std::vector<char>& payload,
+                          const Completion<ExchangeResult>& handler)
+{
+  if (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength)
   {
-    boost::asio::streambuf buf;
-    read_until_timeout(buf, "READY\r\n", ec, 10);
+    handler(boost::system::errc::make_error_code(
+      boost::system::errc::invalid_argument
+    ), ExchangeResult());
+    return;
+  }
+  std::shared_ptr<std::string> command;
+  std::shared_ptr<std::string> data;
+  if (!payload.empty()) prepareMessage(payload, command, data);
+  submit<ExchangeResult>(handler, [this, command, data](const Completion<ExchangeResult>& done) {
+    auto state = std::make_shared<ExchangeState>();
+    state->done = done;
+    if (!command)
+    {
+      // только проверка почтового ящика: оставшееся в буфере MO-сообщение
+      // не должно уйти с сеансом
+      clearMoStep([this, state](const boost::system::error_code& ec) {
+        if (ec) state->done(ec, state->result);
+          else exchangeSession(state);
+      });
+      return;
+    }
+    writeMessageStep(command, data, [this, state](const boost::system::error_code& ec,
+                                                  const uint8_t& code) {
+      state->result.write_status = code;
+      if (ec)
+      {
+        state->done(ec, state->result);
+        return;
+      }
+      if (code)
+      {
+        state->done(boost::system::errc::make_error_code(
+          boost::system::errc::protocol_error
+        ), state->result);
+        return;
+      }
+      state->moPending = true;
+      state->result.mo_written = true;
+      exchangeSession(state);
+    });
+  });
+}
+
+void Modem::exchangeSession(const std::shared_ptr<ExchangeState>& state)
+{
+  sessionStep(false, [this, state](const boost::system::error_code& ec,
+                                   const SbdSessionStatus& status) {
+    ExchangeResult& result = state->result;
     if (ec)
-      throw std::runtime_error("reply receive error");
+    {
+      exchangeFinish(state, ec);
+      return;
+    }
+    if (!result.sessions) result.session = status;
+    result.sessions++;
+    result.mt_queue = status.mt_queue;
+    state->last = status;
+    // MO status 0-4 -- сообщение передано
+    if (state->moPending && (status.mo_status <= 4))
+    {
+      state->moPending = false;
+      state->moSent = true;
+    }
+    if (status.mt_status != 1)
+    {
+      exchangeNext(state);
+      return;
+    }
+    readMessageStep([this, state](const boost::system::error_code& ec,
+                                  const std::vector<char>& payload) {
+      if (ec && state->moSent)
+      {
+        // переданное MO-сообщение все равно удаляется, иначе следующий
+        // сеанс отправит его повторно; чтение могло быть прервано, ответ
+        // на него пропускается
+        state->moSent = false;
+        resyncStep([this, state, ec]() {
+          clearMoStep([this, state, ec](const boost::system::error_code& error) {
+            (void)error;
+            exchangeFinish(state, ec);
+          });
+        });
+        return;
+      }
+      if (ec)
+      {
+        exchangeFinish(state, ec);
+        return;
+      }
+      if (!payload.empty()) state->result.mt.push_back(payload);
+      exchangeNext(state);
+    });
+  });
+}
+
+void Modem::exchangeNext(const std::shared_ptr<ExchangeState>& state)
+{
+  // непереданное MO-сообщение и ошибку приема MT оставляем вызывающему
+  bool more = !state->moPending && (state->last.mt_status != 2) &&
+              state->last.mt_queue &&
+              (state->result.sessions < MaxExchangeSessions);
+  if (!state->moSent)
+  {
+    if (more) exchangeSession(state);
+      else exchangeFinish(state, boost::system::error_code());
+    return;
   }
-  boost::asio::write(m_io, boost::asio::buffer(payload), ec);
-  if (ec)
-    throw std::runtime_error("send payload error");
-  boost::asio::write(m_io, boost::asio::buffer(crc.c), ec);
-  if (ec)
-    throw std::runtime_error("send CRC error");
+  // переданное MO-сообщение удаляется, чтобы следующий сеанс его не повторил
+  state->moSent = false;
+  clearMoStep([this, state, more](const boost::system::error_code& ec) {
+    if (!ec && more) exchangeSession(state);
+      else exchangeFinish(state, ec);
+  });
+}
+
+void Modem::exchangeFinish(const std::shared_ptr<ExchangeState>& state,
+                           const boost::system::error_code& ec)
+{
+  // после первого сеанса ошибка только прекращает прием очереди: принятые
+  // MT-сообщения в буфере модема уже не сохранить
+  state->done(state->result.sessions ? boost::system::error_code() : ec,
+              state->result);
+}
+
+void Modem::startCommand(const std::string& command, uint16_t timeout,
+                         const Completion<AtResponse>& handler)
+{
+  auto data = std::make_shared<std::string>(command);
+  submit<AtResponse>(handler, [this, data, timeout](const Completion<AtResponse>& done) {
+    commandStep(data, timeout, done);
+  });
+}
+
+void Modem::commandStep(const std::shared_ptr<std::string>& command,
+                        uint16_t timeout, const Completion<AtResponse>& handler)
+{
+  writeStep(command, 5, [this, timeout, handler](const boost::system::error_code& ec) {
+    if (ec) handler(ec, AtResponse());
+      else readUntilStep("OK\r\n", timeout, handler);
+  });
+}
+
+void Modem::clearMoStep(const std::function<void (const boost::system::error_code&)>& handler)
+{
   // return:
   // 0
-  // 
+  //
   // OK
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 5);
-  std::istream is(&buf);
-  std::string line;
-  std::getline(is, line);
-  std::getline(is, line);
-  std::string::size_type pos = std::string::npos;
-  uint8_t res;
-  pos = line.find_first_of('\r');
-  try
+  auto command = std::make_shared<std::string>("AT+SBDD0\r");
+  commandStep(command, 5, [handler](const boost::system::error_code& ec,
+                                    const AtResponse& response) {
+    int32_t code;
+    if (ec) handler(ec);
+      else if (!response.resultCode(code) || code)
+        handler(boost::system::errc::make_error_code(
+          boost::system::errc::protocol_error
+        ));
+      else handler(ec);
+  });
+}
+
+void Modem::writeMessageStep(const std::shared_ptr<std::string>& command,
+                             const std::shared_ptr<std::string>& data,
+                             const Completion<uint8_t>& handler)
+{
+  writeStep(command, 5, [this, data, handler](const boost::system::error_code& ec) {
+    if (ec)
+    {
+      handler(ec, 4);
+      return;
+    }
+    // return:
+    // READY<CR><LF>
+    // hex: 52 45 41 44 59 0D 0A
+    readUntilStep("READY\r\n", 10, [this, data, handler](const boost::system::error_code& ec,
+                                                         const AtResponse& response) {
+      (void)response;
+      if (ec)
+      {
+        handler(ec, 4);
+        return;
+      }
+      writeStep(data, 5, [this, handler](const boost::system::error_code& ec) {
+        if (ec)
+        {
+          handler(ec, 4);
+          return;
+        }
+        // return:
+        // 0
+        //
+        // OK
+        readUntilStep("OK\r\n", 5, [handler](const boost::system::error_code& ec,
+                                            const AtResponse& response) {
+          int32_t code;
+          if (ec) handler(ec, 4);
+            else if (!response.resultCode(code) || (code < 0) || (code > 3))
+              handler(badMessage(), 4);
+            else handler(ec, uint8_t(code));
+        });
+      });
+    });
+  });
+}
+
+void Modem::readMessageStep(const Completion<std::vector<char> >& handler)
+{
+  auto command = std::make_shared<std::string>("AT+SBDRB\r");
+  const std::vector<char> none;
+  writeStep(command, 5, [this, handler, none](const boost::system::error_code& ec) {
+    if (ec)
+    {
+      handler(ec, none);
+      return;
+    }
+    // get echo of command or empty line
+    readUntilStep("\r", 5, [this, handler, none](const boost::system::error_code& ec,
+                                               const AtResponse& response) {
+      (void)response;
+      if (ec)
+      {
+        handler(ec, none);
+        return;
+      }
+      // Iridium ISU AT Command Reference, p. 8.11:
+      //
+      // * The SBD message is transferred formatted as follows:
+      //   {2-byte message length} + {binary SBD message} + {2-byte checksum}
+      // ...
+      // * If there is no mobile terminated SBD message waiting to be retrieved
+      //   from the ISU, the message length and checksum fields will be zero.
+      readStep(2, 5, [this, handler, none](const boost::system::error_code& ec,
+                                         const AtResponse& length) {
+        if (ec)
+        {
+          handler(ec, none);
+          return;
+        }
+        const char* l = length.data();
+        size_t size = (uint8_t(l[0]) << 8) | uint8_t(l[1]);
+        readStep(size + 2, 5, [this, handler, none, size](const boost::system::error_code& ec,
+                                                        const AtResponse& message) {
+          if (ec)
+          {
+            handler(ec, none);
+            return;
+          }
+          const char* data = message.data();
+          std::vector<char> payload(data, data + size);
+          uint16_t received = (uint8_t(data[size]) << 8) | uint8_t(data[size + 1]);
+          uint32_t crc = 0;
+          for (char c: payload) crc += c;
+          if (!payload.empty() && ((crc & 0xFFFF) != received))
+          {
+            handler(badMessage(), none);
+            return;
+          }
+          readUntilStep("OK\r\n", 5, [handler, payload](const boost::system::error_code& ec,
+                                                       const AtResponse& response) {
+            (void)ec;
+            (void)response;
+            // сообщение уже получено, итоговый код не важен
+            handler(boost::system::error_code(), payload);
+          });
+        });
+      });
+    });
+  });
+}
+
+void Modem::sessionStep(bool answer,
+                        const Completion<SbdSessionStatus>& handler)
+{
+  // return:
+  // +SBDIX: 32, 13, 2, 0, 0, 0
+  //
+  // OK
+  auto command = std::make_shared<std::string>(answer ? "AT+SBDIXA\r" :
+                                                        "AT+SBDIX\r");
+  commandStep(command, 50, [handler](const boost::system::error_code& ec,
+                                     const AtResponse& response) {
+    SbdSessionStatus status;
+    int32_t fields[6];
+    size_t count;
+    if (ec)
+    {
+      handler(ec, status);
+      return;
+    }
+    if (!response.fields("+SBDIX:", fields, 6, count) || (count < 6))
+    {
+      handler(badMessage(), status);
+      return;
+    }
+    status.mo_status = uint8_t(fields[0]);
+    status.momsn = uint16_t(fields[1]);
+    status.mt_status = uint8_t(fields[2]);
+    status.mtmsn = uint16_t(fields[3]);
+    status.mt_message_len = uint16_t(fields[4]);
+    status.mt_queue = uint8_t(fields[5]);
+    handler(ec, status);
+  });
+}
+
+template <class Result>
+boost::system::error_code Modem::execute(
+  const std::string& command, uint16_t timeout,
+  const std::function<bool (const AtResponse&, Result&)>& parse,
+  Result& result)
+{
+  return await<Result>([this, &command, timeout, parse](const Completion<Result>& handler) {
+    startCommand(command, timeout, [handler, parse](const boost::system::error_code& ec,
+                                                    const AtResponse& response) {
+      // ответ разбирается здесь: буфер приема действителен только в
+      // обработчике
+      Result value = Result();
+      if (!ec && !parse(response, value)) handler(badMessage(), value);
+        else handler(ec, value);
+    });
+  }, result);
+}
+
+template <class Result>
+void Modem::submit(const Completion<Result>& handler,
+                   const std::function<void (const Completion<Result>&)>& body)
+{
+  if (m_closing || !m_ioActive)
   {
-    res = boost::numeric_cast<uint8_t>(boost::lexical_cast<int>(line.data(), pos));
+    handler(m_ioActive ? boost::asio::error::operation_aborted :
+                         boost::asio::error::not_connected,
+            Result());
+    return;
   }
-  catch (boost::bad_lexical_cast& e)
+  Operation operation;
+  operation.abort = [handler](const boost::system::error_code& ec) {
+    handler(ec, Result());
+  };
+  operation.start = [this, handler, body]() {
+    body([this, handler](const boost::system::error_code& ec,
+                         const Result& result) {
+      // нераспознанный ответ мог принадлежать прерванной ранее команде,
+      // тогда ответ этой еще придет
+      if (ec == boost::system::errc::bad_message) m_dirty = true;
+      handler(ec, result);
+      nextOperation();
+    });
+  };
+  m_ioService.post(track([this, operation]() {
+    if (m_closing)
+    {
+      operation.abort(boost::asio::error::operation_aborted);
+      return;
+    }
+    m_operations.push_back(operation);
+    if (!m_busy) nextOperation();
+  }));
+}
+
+void Modem::nextOperation()
+{
+  m_busy = false;
+  if (m_operations.empty())
   {
-    res = 4; // nonexistent return code
+    listen();
+    return;
   }
-  return res;
+  Operation operation = m_operations.front();
+  m_operations.pop_front();
+  m_busy = true;
+  m_cancelled = false;
+  if (m_listening)
+  {
+    // порт занят ожиданием незапрошенных сообщений
+    m_pendingStart = operation.start;
+    boost::system::error_code ec;
+    m_io.cancel(ec);
+    return;
+  }
+  startOperation(operation.start);
 }
 
-void Modem::ReadMessage(std::vector<char>& payload)
+void Modem::startOperation(const std::function<void ()>& start)
 {
-  payload.clear();
-  if (!isOpen())
-    throw std::runtime_error("modem not opened");
-  boost::system::error_code ec;
-  boost::asio::write(m_io, boost::asio::buffer("AT+SBDRB\r", 9), ec);
-  if (ec)
-    throw std::runtime_error("send command error");
+  resyncStep([this, start]() {
+    // остаток ответа предыдущей операции
+    drainUnsolicited();
+    start();
+  });
+}
+
+void Modem::resyncStep(const std::function<void ()>& handler)
+{
+  while (m_dirty)
   {
-    // get echo of command or empty line
-    boost::asio::streambuf buf;
-    read_until_timeout(buf, "\r", ec, 5);
-    if (ec)
-      throw std::runtime_error("message length receive error");
+    const char* begin = m_rx.data() + m_rxBegin;
+    const char* eol = static_cast<const char*>(
+      std::memchr(begin, '\n', m_rxEnd - m_rxBegin)
+    );
+    if (!eol) break;
+    m_rxBegin += eol + 1 - begin;
+    if (!handleUnsolicited(begin, eol + 1) && isFinalResult(begin, eol + 1))
+      m_dirty = false;
   }
-  union {
-    uint16_t i;
-    char c[2];
-  } smallBuf = { 0 };
-  boost::asio::read(m_io, boost::asio::buffer(smallBuf.c), ec);
-  if (ec)
-    throw std::runtime_error("message length receive error");
-  // Iridium ISU AT Command Reference, p. 8.11:
-  //
-  // * The SBD message is transferred formatted as follows:
-  //   {2-byte message length} + {binary SBD message} + {2-byte checksum}
-  // ...
-  // * If there is no mobile terminated SBD message waiting to be retrieved
-  //   from the ISU, the message length and checksum fields will be zero.
-  if (!isBigEndian()) std::swap(smallBuf.c[0], smallBuf.c[1]);
-  if (smallBuf.i)
+  if (!m_dirty || m_cancelled)
   {
-    payload.resize(smallBuf.i, 0);
-    boost::asio::read(m_io, boost::asio::buffer(payload), ec);
-    if (ec)
+    handler();
+    return;
+  }
+  // строка длиннее буфера -- не ответ на команду
+  if (m_rxEnd - m_rxBegin == m_rx.size()) m_rxBegin = m_rxEnd = 0;
+  arm(ResyncQuietTime);
+  receive([this, handler](const boost::system::error_code& error) {
+    boost::system::error_code ec = disarm(error);
+    if (ec == boost::asio::error::timed_out)
     {
-      payload.clear();
-      throw std::runtime_error("message receive error");
+      // модем молчит: остаток ответа больше не придет
+      m_dirty = false;
+      m_rxBegin = m_rxEnd = 0;
     }
-  }
-  smallBuf.i = 0;
-  boost::asio::read(m_io, boost::asio::buffer(smallBuf.c), ec);
-  if (ec)
+    if (ec) handler();
+      else resyncStep(handler);
+  });
+}
+
+void Modem::listen()
+{
+  if (m_busy || m_listening || m_closing || !m_io.is_open()) return;
+  // строка длиннее буфера -- не незапрошенное сообщение
+  if (m_rxEnd - m_rxBegin == m_rx.size()) m_rxBegin = m_rxEnd = 0;
+  m_listening = true;
+  receive([this](const boost::system::error_code& ec) {
+    m_listening = false;
+    // полные строки; неполная остается в буфере
+    while (true)
+    {
+      const char* begin = m_rx.data() + m_rxBegin;
+      const char* eol = static_cast<const char*>(
+        std::memchr(begin, '\n', m_rxEnd - m_rxBegin)
+      );
+      if (!eol) break;
+      m_rxBegin += eol + 1 - begin;
+      // ответ прерванной команды пришел, пока модем свободен
+      if (!handleUnsolicited(begin, eol + 1) && isFinalResult(begin, eol + 1))
+        m_dirty = false;
+    }
+    if (m_pendingStart)
+    {
+      std::function<void ()> start;
+      start.swap(m_pendingStart);
+      startOperation(start);
+      return;
+    }
+    // ошибка порта: ожидание возобновится после следующей операции
+    if (!ec || (ec == boost::asio::error::operation_aborted)) listen();
+  });
+}
+
+void Modem::drainUnsolicited()
+{
+  const char* p = m_rx.data() + m_rxBegin;
+  const char* end = m_rx.data() + m_rxEnd;
+  while (p < end)
   {
-    payload.clear();
-    throw std::runtime_error("message CRC receive error");
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!eol) break; // неполная строка
+    handleUnsolicited(p, eol + 1);
+    p = eol + 1;
   }
-  if (!isBigEndian()) std::swap(smallBuf.c[0], smallBuf.c[1]);
-  if (!payload.empty())
+  m_rxBegin = m_rxEnd = 0;
+}
+
+size_t Modem::stripUnsolicited(char* data, size_t size)
+{
+  char* p = data;
+  char* end = data + size;
+  while (p < end)
   {
-    uint32_t crc = 0;
-    for (char c: payload) crc += c;
-    if ((crc & 0xFFFF) != smallBuf.i)
+    char* eol = static_cast<char*>(std::memchr(p, '\n', end - p));
+    char* next = eol ? eol + 1 : end;
+    if (handleUnsolicited(p, next))
     {
-      payload.clear();
-      throw std::runtime_error("CRC check error");
+      std::memmove(p, next, end - next);
+      end -= next - p;
     }
+    else p = next;
   }
+  return end - data;
+}
+
+bool Modem::handleUnsolicited(const char* begin, const char* end)
+{
+  while ((begin < end) && std::strchr(" \r\n", *begin)) begin++;
+  while ((end > begin) && std::strchr(" \r\n", *(end - 1))) end--;
+  static const char Ring[] = "SBDRING";
+  static const char Indicator[] = "+CIEV:";
+  size_t length = end - begin;
+  if ((length == sizeof(Ring) - 1) && !std::memcmp(begin, Ring, length))
   {
-    boost::asio::streambuf buf;
-    read_until_timeout(buf, "OK\r\n", ec, 5);
+    if (m_ringCallback) m_service.post(m_ringCallback);
+    return true;
   }
+  if ((length < sizeof(Indicator) - 1) ||
+      std::memcmp(begin, Indicator, sizeof(Indicator) - 1))
+    return false;
+  // +CIEV:<indicator>,<value>
+  int32_t fields[2];
+  size_t count;
+  if (!AtResponse::parseFields(begin + sizeof(Indicator) - 1, end, fields, 2,
+                               count) ||
+      (count < 2) || (fields[0] < eSignalIndicator) ||
+      (fields[0] > eAntennaIndicator) || (fields[1] < 0))
+    return true;
+  EIndicator indicator = EIndicator(fields[0]);
+  uint8_t value = uint8_t(fields[1]);
+  if (indicator == eSignalIndicator) m_signalQuality = value;
+  if (indicator == eServiceIndicator) m_serviceAvailable = value;
+  if (m_indicatorCallback)
+    m_service.post(std::bind(m_indicatorCallback, indicator, value));
+  return true;
 }
 
-Modem::SbdSessionStatus Modem::DoSbdSession(bool answer)
+void Modem::writeStep(const std::shared_ptr<std::string>& data,
+                      uint16_t timeout,
+                      const std::function<void (const boost::system::error_code&)>& handler)
 {
-  if (!isOpen())
-    throw std::runtime_error("modem not opened");
-  boost::system::error_code ec;
-  const char* cmd = answer ? "AT+SBDIXA\r" : "AT+SBDIX\r";
-  boost::asio::write(m_io, boost::asio::buffer(cmd, (answer ? 10 : 9)), ec);
-  if (ec)
-    throw std::runtime_error("send command error");
-  // return:
-  // +SBDIX: 32, 13, 2, 0, 0, 0
-  // 
-  // OK
-  SbdSessionStatus status;
-  boost::asio::streambuf buf;
-  read_until_timeout(buf, "OK\r\n", ec, 50);
-  if (ec) throw std::runtime_error(ec.message());
-  std::istream is(&buf);
-  std::string line;
-  std::string::size_type pos2, pos = std::string::npos;
-  std::getline(is, line);
-  std::getline(is, line);
-  pos = line.find("+SBDIX: ");
-  if (pos == std::string::npos)
-    throw std::runtime_error("bad session status");
-  pos += 8;
-  pos2 = line.find_first_of(',', pos);
-  try
+  if (m_cancelled)
   {
-    status.mo_status = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
+    handler(boost::asio::error::operation_aborted);
+    return;
   }
-  catch (boost::bad_lexical_cast& e)
+  arm(timeout);
+  boost::asio::async_write(m_io, boost::asio::buffer(*data),
+    track([this, data, handler](const boost::system::error_code& ec, std::size_t size) {
+      (void)size;
+      handler(disarm(ec));
+  }));
+}
+
+void Modem::receive(const std::function<void (const boost::system::error_code&)>& handler)
+{
+  if (m_rxBegin)
   {
-    throw std::runtime_error("bad session status");
+    std::memmove(m_rx.data(), m_rx.data() + m_rxBegin, m_rxEnd - m_rxBegin);
+    m_rxEnd -= m_rxBegin;
+    m_rxBegin = 0;
   }
-  pos = pos2 + 2;
-  pos2 = line.find_first_of(',', pos);
-  try
+  if (m_rxEnd == m_rx.size())
   {
-    status.momsn = boost::lexical_cast<uint16_t>(line.data() + pos, pos2 - pos);
+    handler(boost::system::errc::make_error_code(
+      boost::system::errc::no_buffer_space
+    ));
+    return;
   }
-  catch (boost::bad_lexical_cast& e)
+  m_io.async_read_some(
+    boost::asio::buffer(m_rx.data() + m_rxEnd, m_rx.size() - m_rxEnd),
+    track([this, handler](const boost::system::error_code& ec, std::size_t size) {
+      m_rxEnd += size;
+      handler(ec);
+  }));
+}
+
+void Modem::readUntilStep(const char* expected, uint16_t timeout,
+                          const Completion<AtResponse>& handler)
+{
+  if (m_cancelled)
   {
-    throw std::runtime_error("bad session status");
+    handler(boost::asio::error::operation_aborted, AtResponse());
+    return;
   }
-  pos = pos2 + 2;
-  pos2 = line.find_first_of(',', pos);
-  try
+  arm(timeout);
+  readUntil(expected, handler);
+}
+
+void Modem::readUntil(const char* expected,
+                      const Completion<AtResponse>& handler)
+{
+  size_t length;
+  char* data = m_rx.data() + m_rxBegin;
+  if (AtResponse::findEnd(data, m_rxEnd - m_rxBegin, expected, length))
   {
-    status.mt_status = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
+    boost::system::error_code ec = disarm(boost::system::error_code());
+    m_rxBegin += length;
+    AtResponse response(data, stripUnsolicited(data, length));
+    if (response.isError())
+      ec = boost::system::errc::make_error_code(
+        boost::system::errc::protocol_error
+      );
+    handler(ec, response);
+    return;
   }
-  catch (boost::bad_lexical_cast& e)
+  receive([this, expected, handler](const boost::system::error_code& error) {
+    if (error)
+    {
+      handler(disarm(error), AtResponse());
+      return;
+    }
+    readUntil(expected, handler);
+  });
+}
+
+void Modem::readStep(size_t size, uint16_t timeout,
+                     const Completion<AtResponse>& handler)
+{
+  if (m_cancelled)
   {
-    throw std::runtime_error("bad session status");
+    handler(boost::asio::error::operation_aborted, AtResponse());
+    return;
   }
-  pos = pos2 + 2;
-  pos2 = line.find_first_of(',', pos);
-  try
+  if (size > m_rx.size())
   {
-    status.mtmsn = boost::lexical_cast<uint16_t>(line.data() + pos, pos2 - pos);
+    handler(boost::system::errc::make_error_code(
+      boost::system::errc::no_buffer_space
+    ), AtResponse());
+    return;
   }
-  catch (boost::bad_lexical_cast& e)
+  arm(timeout);
+  read(size, handler);
+}
+
+void Modem::read(size_t size, const Completion<AtResponse>& handler)
+{
+  if (m_rxEnd - m_rxBegin >= size)
   {
-    throw std::runtime_error("bad session status");
+    boost::system::error_code ec = disarm(boost::system::error_code());
+    AtResponse data(m_rx.data() + m_rxBegin, size);
+    m_rxBegin += size;
+    handler(ec, data);
+    return;
   }
-  pos = pos2 + 2;
-  pos2 = line.find_first_of(',', pos);
-  try
+  receive([this, size, handler](const boost::system::error_code& error) {
+    if (error)
+    {
+      handler(disarm(error), AtResponse());
+      return;
+    }
+    read(size, handler);
+  });
+}
+
+void Modem::arm(uint16_t timeout)
+{
+  uint32_t seq = ++m_stepSeq;
+  m_timedOut = false;
+  m_timer.expires_from_now(std::chrono::seconds(timeout));
+  m_timer.async_wait(track([this, seq](const boost::system::error_code& error) {
+    if ((error == boost::asio::error::operation_aborted) ||
+        (seq != m_stepSeq)) return;
+    m_timedOut = true;
+    boost::system::error_code ec;
+    m_io.cancel(ec);
+  }));
+}
+
+boost::system::error_code Modem::disarm(const boost::system::error_code& ec)
+{
+  m_stepSeq++;
+  boost::system::error_code error;
+  m_timer.cancel(error);
+  if (ec == boost::asio::error::operation_aborted)
   {
-    status.mt_message_len = boost::lexical_cast<uint16_t>(line.data() + pos, pos2 - pos);
+    // ответ на прерванный шаг может прийти позже
+    m_dirty = true;
+    if (m_timedOut) return boost::asio::error::timed_out;
   }
-  catch (boost::bad_lexical_cast& e)
+  return ec;
+}
+
+void Modem::startIo()
+{
+  if (m_ioActive) return;
+  if (m_ownService)
   {
-    throw std::runtime_error("bad session status");
+    m_ioService.reset();
+    m_ioWork.reset(new boost::asio::io_service::work(m_ioService));
+    m_ioThread = std::thread([this]() {
+      m_ioService.run();
+    });
   }
-  pos = pos2 + 2;
-  pos2 = line.find_first_of('\r', pos);
-  try
+  m_ioActive = true;
+  m_ioService.post(track([this]() { listen(); }));
+}
+
+void Modem::stopIo()
+{
+  if (!m_ioActive) return;
+  if (m_ownService)
   {
-    status.mt_queue = boost::numeric_cast<uint8_t>(
-      boost::lexical_cast<int>(line.data() + pos, pos2 - pos)
-    );
+    m_ioWork.reset();
+    m_ioThread.join();
+    m_ioService.reset();
   }
-  catch (boost::bad_lexical_cast& e)
+  else
   {
-    throw std::runtime_error("bad session status");
+    std::unique_lock<std::mutex> lock(m_pendingMutex);
+    m_pendingCond.wait(lock, [this]() { return m_pending.load() == 0; });
   }
-  return status;
+  m_ioActive = false;
 }
 
-void Modem::read_until_timeout(boost::asio::streambuf& buf,
-                               const std::string& delim,
-                               boost::system::error_code& ec, uint16_t timeout)
+void Modem::release()
 {
-  std::unique_lock<std::mutex> lock(m_mutex);
-  std::atomic<bool> complete(false);
-  std::condition_variable cond;
-  m_timer.expires_from_now(std::chrono::seconds(timeout));
-  m_timer.async_wait([this](const boost::system::error_code& error) {
-    (void)error;
-    m_io.cancel();
-  });
-  boost::asio::async_read_until(m_io, buf, delim,
-    [this, &complete, &cond, &ec](const boost::system::error_code& error, std::size_t size) {
-      (void)size;
-      ec = error;
-      m_timer.cancel();
-      complete.store(true, std::memory_order_relaxed);
-      cond.notify_one();
-  });
-  std::thread thread([this]() {
-    m_ioService.run();
-  });
-  while (!complete.load(std::memory_order_relaxed))
-    cond.wait_for(lock, std::chrono::milliseconds(250));
-  thread.join();
-  m_ioService.reset();
+  // под мутексом: Close() не должен завершиться, пока release() обращается
+  // к экземпляру
+  std::lock_guard<std::mutex> lock(m_pendingMutex);
+  (void)lock;
+  if (m_pending.fetch_sub(1) == 1) m_pendingCond.notify_all();
 }
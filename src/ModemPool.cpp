@@ -0,0 +1,433 @@
+#include <limits>
+#include <stdexcept>
+#include "iridium/IEMoPayload.hpp" // max payload size
+#include "iridium/ModemPool.hpp"
+
+namespace {
+
+///
+/// Вес последнего сеанса в скользящей доле успешных сеансов.
+///
+const double ReliabilityWeight = 0.2;
+
+inline bool registered(uint8_t netStatus)
+{
+  // home network or roaming
+  return (netStatus == 1) || (netStatus == 5);
+}
+
+}
+
+using namespace Iridium;
+
+const size_t ModemPool::None = std::numeric_limits<size_t>::max();
+const unsigned int ModemPool::DefaultFailureThreshold = 3;
+const std::chrono::milliseconds ModemPool::DefaultOpenInterval(60000);
+const std::chrono::milliseconds ModemPool::DefaultProbeInterval(30000);
+
+ModemPool::ModemPool(boost::asio::io_service& service):
+  m_service(service),
+  m_probeTimer(service),
+  m_dispatchTimer(service),
+  m_threshold(DefaultFailureThreshold),
+  m_interval(DefaultOpenInterval),
+  m_probeInterval(DefaultProbeInterval),
+  m_minSignal(1),
+  m_running(false),
+  m_nextId(1)
+{
+}
+
+ModemPool::~ModemPool()
+{
+  m_running = false;
+  // обработчики в цикле больше не обращаются к набору, выполняющиеся
+  // завершены: таймеры отменяются здесь
+  m_guard.close();
+  cancelTimers();
+  closeModems();
+}
+
+size_t ModemPool::add(const std::string& device)
+{
+  std::unique_ptr<Unit> unit(new Unit);
+  unit->modem.reset(new Modem(m_service, device, m_reactor));
+  unit->timer.reset(new boost::asio::steady_timer(m_service));
+  unit->device = device;
+  unit->open = false;
+  unit->busy = false;
+  unit->state = eClosed;
+  unit->netStatus = 4;
+  unit->signal = -1;
+  unit->reliability = 1;
+  unit->failures = 0;
+  unit->successes = unit->errors = 0;
+  unit->expectedMomsn = 0;
+  unit->unknown = false;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_units.push_back(std::move(unit));
+  return m_units.size() - 1;
+}
+
+Modem& ModemPool::modem(size_t index)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return *m_units.at(index)->modem;
+}
+
+void ModemPool::setBreaker(unsigned int threshold,
+                           std::chrono::milliseconds const& interval)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_threshold = threshold ? threshold : 1;
+  m_interval = interval;
+}
+
+size_t ModemPool::open()
+{
+  size_t opened = 0;
+  for (auto& unit: m_units)
+  {
+    if (!unit->modem->isOpen())
+    {
+      try
+      {
+        unit->modem->Open();
+      }
+      catch (std::runtime_error&)
+      {
+        // модем не используется до следующего open()
+      }
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    unit->open = unit->modem->isOpen();
+    if (unit->open) opened++;
+  }
+  m_running = true;
+  m_service.post(guard([this]() {
+    probe();
+    // сообщения с неизвестным итогом ждут проверки на своих модемах; модем,
+    // который не открылся, проверку не выполнит -- сообщение возвращается в
+    // очередь
+    for (size_t i = 0; i < m_units.size(); i++)
+    {
+      bool unknown;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        (void)lock;
+        Unit& unit = *m_units[i];
+        unknown = unit.open && unit.unknown;
+        if (!unit.open && unit.unknown)
+        {
+          unit.unknown = false;
+          unit.busy = false;
+          m_queue.push_front(std::move(unit.job));
+        }
+      }
+      if (unknown) verify(i);
+    }
+    dispatch();
+  }));
+  return opened;
+}
+
+void ModemPool::close()
+{
+  m_running = false;
+  // таймеры не потокобезопасны
+  m_service.post(guard([this]() { cancelTimers(); }));
+  closeModems();
+}
+
+void ModemPool::cancelTimers()
+{
+  m_probeTimer.cancel();
+  m_dispatchTimer.cancel();
+  for (auto& unit: m_units) unit->timer->cancel();
+}
+
+void ModemPool::closeModems()
+{
+  for (auto& unit: m_units)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      (void)lock;
+      unit->open = false;
+    }
+    // прерванные сеансы возвращают сообщения в очередь
+    unit->modem->Close(true);
+  }
+}
+
+uint64_t ModemPool::post(const std::vector<char>& payload)
+{
+  if (payload.empty() ||
+      (payload.size() > SbdDirectIp::IEMoPayload::MaxPayloadLength))
+    throw std::runtime_error("bad payload length");
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    id = m_nextId++;
+    m_queue.push_back(Job{ id, payload, 0 });
+  }
+  m_service.post(guard([this]() { dispatch(); }));
+  return id;
+}
+
+size_t ModemPool::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_queue.size();
+}
+
+size_t ModemPool::modems() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_units.size();
+}
+
+std::vector<ModemPool::Status> ModemPool::status() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  std::vector<Status> out;
+  out.reserve(m_units.size());
+  for (auto& unit: m_units)
+  {
+    Status s;
+    s.device = unit->device;
+    s.open = unit->open;
+    s.busy = unit->busy;
+    s.state = unit->state;
+    s.net_status = unit->netStatus;
+    s.signal = unit->modem->signalQuality();
+    if (s.signal < 0) s.signal = unit->signal;
+    s.reliability = unit->reliability;
+    s.score = unit->open ? score(*unit) : 0;
+    s.failures = unit->failures;
+    s.successes = unit->successes;
+    s.errors = unit->errors;
+    out.push_back(s);
+  }
+  return out;
+}
+
+double ModemPool::score(const Unit& unit) const
+{
+  if (unit.modem->serviceAvailable() == 0) return 0;
+  int signal = unit.modem->signalQuality();
+  if (signal < 0) signal = unit.signal;
+  // уровень сигнала неизвестен: модем допускается с наименьшей оценкой
+  if (signal < 0) signal = m_minSignal;
+  if (signal < m_minSignal) return 0;
+  double score = (signal + 1) * unit.reliability;
+  if (!registered(unit.netStatus)) score /= 2;
+  return score;
+}
+
+void ModemPool::dispatch()
+{
+  while (m_running)
+  {
+    size_t index = None;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      (void)lock;
+      if (m_queue.empty()) return;
+      Clock::time_point now = Clock::now();
+      Clock::time_point wake = Clock::time_point::max();
+      double best = 0;
+      for (size_t i = 0; i < m_units.size(); i++)
+      {
+        const Unit& unit = *m_units[i];
+        if (!unit.open || unit.busy) continue;
+        // пробный сеанс, не сообщивший итог, не блокирует модем навсегда
+        if ((unit.state != eClosed) && (unit.until > now))
+        {
+          if (unit.until < wake) wake = unit.until;
+          continue;
+        }
+        double s = score(unit);
+        if (s > best)
+        {
+          best = s;
+          index = i;
+        }
+      }
+      if (index == None)
+      {
+        // модемы с плохим сигналом ждут probe(), исключенные -- окончания
+        // интервала восстановления
+        if (wake != Clock::time_point::max())
+        {
+          m_dispatchTimer.expires_at(wake);
+          m_dispatchTimer.async_wait(guard([this](const boost::system::error_code& ec) {
+            if (ec != boost::asio::error::operation_aborted) dispatch();
+          }));
+        }
+        return;
+      }
+      Unit& unit = *m_units[index];
+      unit.busy = true;
+      if (unit.state != eClosed)
+      {
+        unit.state = eHalfOpen;
+        unit.until = now + m_interval;
+      }
+      unit.job = std::move(m_queue.front());
+      unit.job.attempts++;
+      m_queue.pop_front();
+    }
+    start(index);
+  }
+}
+
+void ModemPool::start(size_t index)
+{
+  Modem& modem = *m_units[index]->modem;
+  modem.async_sbd_get_status(guard([this, index](const boost::system::error_code& ec,
+                                                 const Modem::SbdStatus& status) {
+    Unit& unit = *m_units[index];
+    if (ec)
+    {
+      failed(index);
+      return;
+    }
+    unit.expectedMomsn = status.momsn;
+    unit.modem->async_exchange(unit.job.payload, guard([this, index](const boost::system::error_code& ec,
+                                                                     const Modem::ExchangeResult& result) {
+      onExchange(index, ec, result);
+    }));
+  }));
+}
+
+void ModemPool::onExchange(size_t index, const boost::system::error_code& ec,
+                           const Modem::ExchangeResult& result)
+{
+  if (m_mtCallback)
+    for (auto& message: result.mt) m_mtCallback(index, message);
+  // MO status 0-4 -- сообщение передано
+  if (!ec && (result.session.mo_status <= 4))
+  {
+    succeeded(index, result.session.momsn, false);
+    return;
+  }
+  // сообщение не попало в модем (в том числе операция отменена в очереди
+  // команд или после закрытия порта): сеанс его не отправлял
+  if (!ec || !result.mo_written)
+  {
+    failed(index);
+    return;
+  }
+  // итог сеанса неизвестен: MOMSN увеличивается только успешным сеансом;
+  // запрос начнется после того, как модем пропустит запоздавший ответ
+  // сеанса
+  verify(index);
+}
+
+void ModemPool::verify(size_t index)
+{
+  Unit& unit = *m_units[index];
+  unit.modem->async_sbd_get_status(guard([this, index](const boost::system::error_code& ec,
+                                                       const Modem::SbdStatus& status) {
+    Unit& unit = *m_units[index];
+    uint16_t expected = unit.expectedMomsn;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      (void)lock;
+      unit.unknown = bool(ec);
+    }
+    if (!ec)
+    {
+      if (status.momsn != expected) succeeded(index, expected, true);
+        else failed(index);
+      return;
+    }
+    // сообщение могло уйти: другому модему оно не передается, модем
+    // остается занятым до успешного запроса
+    if (!m_running) return;
+    unit.timer->expires_from_now(m_probeInterval);
+    unit.timer->async_wait(guard([this, index](const boost::system::error_code& ec) {
+      if ((ec != boost::asio::error::operation_aborted) && m_running)
+        verify(index);
+    }));
+  }));
+}
+
+void ModemPool::succeeded(size_t index, uint16_t momsn, bool inferred)
+{
+  Delivery delivery;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    Unit& unit = *m_units[index];
+    unit.busy = false;
+    unit.state = eClosed;
+    unit.failures = 0;
+    unit.successes++;
+    unit.reliability += ReliabilityWeight * (1 - unit.reliability);
+    delivery.id = unit.job.id;
+    delivery.attempts = unit.job.attempts;
+    unit.job.payload.clear();
+  }
+  delivery.modem = index;
+  delivery.momsn = momsn;
+  delivery.inferred = inferred;
+  if (m_deliveryCallback) m_deliveryCallback(delivery);
+  dispatch();
+}
+
+void ModemPool::failed(size_t index)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    Unit& unit = *m_units[index];
+    unit.busy = false;
+    unit.failures++;
+    unit.errors++;
+    unit.reliability -= ReliabilityWeight * unit.reliability;
+    if ((unit.state == eHalfOpen) || (unit.failures >= m_threshold))
+    {
+      unit.state = eOpen;
+      unit.until = Clock::now() + m_interval;
+    }
+    // сообщение передаст другой модем
+    m_queue.push_front(std::move(unit.job));
+  }
+  dispatch();
+}
+
+void ModemPool::probe()
+{
+  if (!m_running) return;
+  for (size_t i = 0; i < m_units.size(); i++)
+  {
+    Modem& modem = *m_units[i]->modem;
+    if (!modem.isOpen()) continue;
+    modem.async_get_status_snapshot(guard([this, i](const boost::system::error_code& ec,
+                                                    const Modem::StatusSnapshot& snapshot) {
+      if (ec) return;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        (void)lock;
+        Unit& unit = *m_units[i];
+        unit.netStatus = snapshot.net_status;
+        unit.signal = snapshot.signal_quality;
+      }
+      dispatch();
+    }));
+  }
+  m_probeTimer.expires_from_now(m_probeInterval);
+  m_probeTimer.async_wait(guard([this](const boost::system::error_code& ec) {
+    if (ec != boost::asio::error::operation_aborted) probe();
+  }));
+}
@@ -0,0 +1,19 @@
+#include "iridium/ModemReactor.hpp"
+
+using namespace Iridium;
+
+ModemReactor::ModemReactor():
+  m_service(),
+  m_work(new boost::asio::io_service::work(m_service))
+{
+  m_thread = std::thread([this]() {
+    m_service.run();
+  });
+}
+
+ModemReactor::~ModemReactor()
+{
+  m_work.reset();
+  m_service.stop();
+  if (m_thread.joinable()) m_thread.join();
+}
@@ -0,0 +1,188 @@
+#include <stdexcept>
+#include "iridium/Codec.hpp"
+#include "iridium/IEMtPayload.hpp"
+#include "iridium/MtCoalescer.hpp"
+#include "iridium/PayloadFraming.hpp"
+
+using namespace Iridium;
+
+const std::chrono::milliseconds MtCoalescer::DefaultHoldTime(2000);
+
+MtCoalescer::MtCoalescer(boost::asio::io_service& service,
+                         SbdTransmitter& transmitter,
+                         std::chrono::milliseconds const& holdTime,
+                         SbdDirectIp::MtMessageFlags flags):
+  m_service(service),
+  m_transmitter(transmitter),
+  m_holdTime(holdTime),
+  m_flags(flags),
+  m_msgId(1)
+{
+}
+
+MtCoalescer::~MtCoalescer()
+{
+  // сработавшие таймеры больше не обращаются к объекту, их пакеты
+  // отправляются здесь
+  m_guard.close();
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+    // ignore transmitter errors
+  }
+}
+
+void MtCoalescer::setHoldTime(std::chrono::milliseconds const& holdTime)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_holdTime = holdTime;
+}
+
+SbdTransmitter::TransmitHandle MtCoalescer::post(
+  const std::string& imei, const char* data, size_t size,
+  const SbdTransmitter::TransmitCallback& callback
+)
+{
+  const size_t limit = SbdDirectIp::IEMtPayload::MaxPayloadLength;
+  if (PayloadFraming::framedSize(size) > limit)
+    throw std::runtime_error("MT message too large to coalesce");
+  auto part = std::make_shared<Part>();
+  part->callback = callback;
+  SbdTransmitter::TransmitHandle handle(part->promise.get_future());
+  Batch full, ready;
+  bool sendFull = false, sendReady = false;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    auto batch = m_batches.find(imei);
+    if ((batch != m_batches.end()) &&
+        (batch->second.payload.size() + PayloadFraming::framedSize(size) > limit))
+    {
+      // сообщение не помещается, пакет отправляется досрочно
+      full = std::move(batch->second);
+      full.timer->cancel();
+      m_batches.erase(batch);
+      batch = m_batches.end();
+      sendFull = true;
+    }
+    if (!m_holdTime.count())
+    {
+      PayloadFraming::pack(ready.payload, data, size);
+      ready.parts.push_back(part);
+      sendReady = true;
+    }
+    else
+    {
+      if (batch == m_batches.end())
+      {
+        batch = m_batches.insert(std::make_pair(imei, Batch())).first;
+        auto timer = std::make_shared<boost::asio::steady_timer>(m_service);
+        batch->second.timer = timer;
+        timer->expires_from_now(m_holdTime);
+        boost::asio::steady_timer* id = timer.get();
+        HandlerGuard::Weak guard = m_guard.weak();
+        timer->async_wait([this, guard, imei, id](const boost::system::error_code& ec) {
+          if (ec == boost::asio::error::operation_aborted) return;
+          HandlerGuard::run(guard, [this, &imei, id]() {
+            Batch expired;
+            {
+              std::lock_guard<std::mutex> lock(m_mutex);
+              (void)lock;
+              auto batch = m_batches.find(imei);
+              // пакет уже отправлен, таймер принадлежит новому пакету
+              if ((batch == m_batches.end()) || (batch->second.timer.get() != id))
+                return;
+              expired = std::move(batch->second);
+              m_batches.erase(batch);
+            }
+            send(imei, expired);
+          });
+        });
+      }
+      PayloadFraming::pack(batch->second.payload, data, size);
+      batch->second.parts.push_back(part);
+    }
+  }
+  if (sendFull) send(imei, full);
+  if (sendReady) send(imei, ready);
+  return handle;
+}
+
+void MtCoalescer::flush()
+{
+  std::map<std::string, Batch> batches;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    batches.swap(m_batches);
+  }
+  for (auto& batch: batches)
+  {
+    batch.second.timer->cancel();
+    send(batch.first, batch.second);
+  }
+}
+
+void MtCoalescer::flush(const std::string& imei)
+{
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    auto i = m_batches.find(imei);
+    if (i == m_batches.end()) return;
+    batch = std::move(i->second);
+    m_batches.erase(i);
+  }
+  batch.timer->cancel();
+  send(imei, batch);
+}
+
+size_t MtCoalescer::pendingDevices() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_batches.size();
+}
+
+void MtCoalescer::send(const std::string& imei, Batch& batch)
+{
+  if (batch.parts.empty()) return;
+  uint32_t msgId;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    msgId = m_msgId++;
+    if (!m_msgId) m_msgId = 1;
+  }
+  auto parts = std::make_shared<std::vector<std::shared_ptr<Part> > >();
+  parts->swap(batch.parts);
+  auto deliver = [parts](const SbdTransmitter::TransmitReport& report) {
+    for (auto& part: *parts)
+    {
+      part->promise.set_value(report);
+      if (part->callback) part->callback(report);
+    }
+  };
+  try
+  {
+    SbdDirectIp::MtMessage message;
+    SbdDirectIp::Codec::factory(message, msgId, imei, batch.payload.data(),
+                                batch.payload.size(), m_flags);
+    m_transmitter.post(message, deliver);
+  }
+  catch (std::runtime_error& e)
+  {
+    // передатчик не принял пакет
+    SbdTransmitter::TransmitReport report;
+    report.outcome = SbdTransmitter::TransmitReport::eDropped;
+    report.messageId = msgId;
+    report.imei = imei;
+    report.posted = report.completed = SbdTransmitter::Clock::now();
+    deliver(report);
+  }
+}
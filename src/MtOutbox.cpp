@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "iridium/MtOutbox.hpp"
+
+namespace {
+
+const char* SegmentPrefix = "mt-";
+const char* SegmentSuffix = ".seg";
+
+enum ERecordType: uint8_t
+{
+  eEnd = 0, ///< Свободное место сегмента (файл заполнен нулями).
+  eEntry = 'E', ///< Сообщение.
+  eAck = 'A' ///< Подтверждение итога сообщения.
+};
+
+#pragma pack(push, 1)
+struct RecordHeader
+{
+  uint32_t m_length; ///< Длина данных записи.
+  uint8_t m_type;
+  uint32_t m_sequenceHigh, m_sequenceLow;
+  uint32_t m_checksum; ///< FNV-1a типа, номера и данных записи.
+};
+#pragma pack(pop)
+
+uint32_t checksum(uint8_t type, uint64_t sequence, const char* data,
+                  size_t size)
+{
+  uint32_t hash = 2166136261u;
+  auto feed = [&hash](uint8_t c) {
+    hash ^= c;
+    hash *= 16777619u;
+  };
+  feed(type);
+  for (int i = 0; i < 8; i++) feed(static_cast<uint8_t>(sequence >> (i * 8)));
+  for (size_t i = 0; i < size; i++) feed(static_cast<uint8_t>(data[i]));
+  return hash;
+}
+
+std::runtime_error systemError(const std::string& what)
+{
+  std::ostringstream err;
+  err << what << ": " << std::strerror(errno);
+  return std::runtime_error(err.str());
+}
+
+}
+
+using namespace Iridium;
+
+const size_t MtOutbox::DefaultSegmentSize = 4 * 1024 * 1024;
+
+///
+/// Сегмент журнала, отображенный в память.
+///
+struct MtOutbox::Segment
+{
+  uint64_t index; ///< Индекс сегмента, входит в имя файла.
+  std::string path;
+  int fd;
+  char* data;
+  size_t size;
+  size_t end; ///< Конец записанных данных.
+  size_t synced; ///< Конец данных, сброшенных на диск.
+  size_t live; ///< Количество неподтвержденных сообщений.
+
+  Segment(): index(0), fd(-1), data(nullptr), size(0), end(0), synced(0),
+             live(0)
+  {}
+
+  ~Segment()
+  {
+    if (data) munmap(data, size);
+    if (fd >= 0) ::close(fd);
+  }
+};
+
+MtOutbox::MtOutbox(const std::string& directory, size_t segmentSize):
+  m_directory(directory),
+  m_segmentSize(segmentSize),
+  m_open(false),
+  m_nextSequence(1)
+{
+}
+
+MtOutbox::~MtOutbox()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+    // ignore flush errors
+  }
+}
+
+void MtOutbox::open()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  if (m_open) return;
+  std::vector<uint64_t> indexes;
+  DIR* dir = opendir(m_directory.c_str());
+  if (!dir) throw systemError("can't open outbox directory " + m_directory);
+  while (struct dirent* entry = readdir(dir))
+  {
+    std::string name(entry->d_name);
+    size_t prefix = std::strlen(SegmentPrefix),
+           suffix = std::strlen(SegmentSuffix);
+    if ((name.size() <= prefix + suffix) ||
+        (name.compare(0, prefix, SegmentPrefix) != 0) ||
+        (name.compare(name.size() - suffix, suffix, SegmentSuffix) != 0))
+      continue;
+    std::string digits(name.substr(prefix, name.size() - prefix - suffix));
+    if (digits.find_first_not_of("0123456789") != std::string::npos) continue;
+    indexes.push_back(std::strtoull(digits.c_str(), nullptr, 10));
+  }
+  closedir(dir);
+  std::sort(indexes.begin(), indexes.end());
+  m_segments.clear();
+  m_live.clear();
+  m_nextSequence = 1;
+  try
+  {
+    for (uint64_t index: indexes)
+    {
+      // индексы должны идти подряд: сегменты удаляются только с начала
+      if (!m_segments.empty() && (index != m_segments.back()->index + 1))
+        throw std::runtime_error("outbox segments sequence is broken");
+      m_segments.push_back(createSegment(index));
+      scanSegment(m_segments.back());
+    }
+    if (m_segments.empty()) m_segments.push_back(createSegment(1));
+  }
+  catch (...)
+  {
+    m_segments.clear();
+    m_live.clear();
+    throw;
+  }
+  m_open = true;
+  removeSegments();
+}
+
+void MtOutbox::close()
+{
+  if (!isOpen()) return;
+  commit();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_unsynced.clear();
+  m_segments.clear();
+  m_live.clear();
+  m_open = false;
+}
+
+void MtOutbox::recover(std::vector<Record>& out) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  out.reserve(out.size() + m_live.size());
+  for (auto& live: m_live)
+  {
+    const Segment& segment = segmentAt(live.second.segment);
+    const char* record = segment.data + live.second.offset;
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    const char* frame = record + sizeof(header);
+    Record r;
+    r.sequence = live.first;
+    r.frame.assign(frame, frame + ntohl(header.m_length));
+    out.push_back(std::move(r));
+  }
+}
+
+uint64_t MtOutbox::append(const std::vector<char>& frame)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  if (!m_open) throw std::runtime_error("outbox not opened");
+  uint64_t sequence = m_nextSequence;
+  write(eEntry, sequence, frame.data(), frame.size());
+  m_nextSequence++;
+  return sequence;
+}
+
+void MtOutbox::acknowledge(uint64_t sequence)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  if (!m_open) throw std::runtime_error("outbox not opened");
+  auto live = m_live.find(sequence);
+  if (live == m_live.end()) return;
+  write(eAck, sequence, nullptr, 0);
+  Segment& segment = segmentAt(live->second.segment);
+  if (segment.live) segment.live--;
+  m_live.erase(live);
+  removeSegments();
+}
+
+void MtOutbox::commit()
+{
+  struct Range
+  {
+    SegmentPtr segment;
+    size_t from, to;
+  };
+  std::vector<Range> ranges;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    if (!m_open) return;
+    for (auto& segment: m_unsynced)
+      if (segment->synced < segment->end)
+        ranges.push_back(Range{ segment, segment->synced, segment->end });
+    SegmentPtr current = m_segments.back();
+    if (current->synced < current->end)
+      ranges.push_back(Range{ current, current->synced, current->end });
+  }
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  for (auto& range: ranges)
+  {
+    size_t from = range.from - (range.from % page);
+    // при ошибке диапазон остается несброшенным и повторяется следующим
+    // вызовом
+    if (msync(range.segment->data + from, range.to - from, MS_SYNC) != 0)
+      throw systemError("outbox commit error");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (void)lock;
+    if (range.segment->synced < range.to) range.segment->synced = range.to;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  m_unsynced.erase(
+    std::remove_if(m_unsynced.begin(), m_unsynced.end(),
+                   [](const SegmentPtr& segment) {
+      return segment->synced >= segment->end;
+    }),
+    m_unsynced.end()
+  );
+}
+
+size_t MtOutbox::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  (void)lock;
+  return m_live.size();
+}
+
+void MtOutbox::write(uint8_t type, uint64_t sequence, const char* data,
+                     size_t size)
+{
+  size_t length = sizeof(RecordHeader) + size;
+  if (length > m_segmentSize)
+    throw std::runtime_error("outbox record is larger than segment");
+  SegmentPtr current = m_segments.back();
+  if (current->end + length > current->size)
+  {
+    SegmentPtr next = createSegment(current->index + 1);
+    m_segments.push_back(next);
+    m_unsynced.push_back(current);
+    current = next;
+  }
+  RecordHeader header;
+  header.m_length = htonl(size);
+  header.m_type = type;
+  header.m_sequenceHigh = htonl(sequence >> 32);
+  header.m_sequenceLow = htonl(sequence & 0xFFFFFFFF);
+  header.m_checksum = htonl(checksum(type, sequence, data, size));
+  char* record = current->data + current->end;
+  if (size) std::memcpy(record + sizeof(header), data, size);
+  std::memcpy(record, &header, sizeof(header));
+  if (type == eEntry)
+  {
+    m_live[sequence] = Location{ current->index, current->end };
+    current->live++;
+  }
+  current->end += length;
+}
+
+MtOutbox::SegmentPtr MtOutbox::createSegment(uint64_t index)
+{
+  std::ostringstream path;
+  path << m_directory << "/" << SegmentPrefix << std::setw(16)
+       << std::setfill('0') << index << SegmentSuffix;
+  SegmentPtr segment = std::make_shared<Segment>();
+  segment->index = index;
+  segment->path = path.str();
+  segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (segment->fd < 0) throw systemError("can't open " + segment->path);
+  struct stat st;
+  if (fstat(segment->fd, &st) != 0)
+    throw systemError("can't stat " + segment->path);
+  segment->size = st.st_size;
+  if (!segment->size)
+  {
+    // новый сегмент
+    if (ftruncate(segment->fd, m_segmentSize) != 0)
+      throw systemError("can't allocate " + segment->path);
+    segment->size = m_segmentSize;
+    int dirFd = ::open(m_directory.c_str(), O_RDONLY);
+    if (dirFd >= 0)
+    {
+      fsync(dirFd);
+      ::close(dirFd);
+    }
+  }
+  void* data = mmap(nullptr, segment->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, segment->fd, 0);
+  if (data == MAP_FAILED) throw systemError("can't map " + segment->path);
+  segment->data = static_cast<char*>(data);
+  return segment;
+}
+
+void MtOutbox::scanSegment(const SegmentPtr& segment)
+{
+  size_t offset = 0;
+  bool torn = false;
+  while (offset + sizeof(RecordHeader) <= segment->size)
+  {
+    RecordHeader header;
+    std::memcpy(&header, segment->data + offset, sizeof(header));
+    size_t length = ntohl(header.m_length);
+    uint64_t sequence = (uint64_t(ntohl(header.m_sequenceHigh)) << 32) |
+                        ntohl(header.m_sequenceLow);
+    if (header.m_type == eEnd) break;
+    const char* data = segment->data + offset + sizeof(header);
+    if (((header.m_type != eEntry) && (header.m_type != eAck)) ||
+        (offset + sizeof(header) + length > segment->size) ||
+        (checksum(header.m_type, sequence, data, length) !=
+         ntohl(header.m_checksum)))
+    {
+      torn = true;
+      break;
+    }
+    if (header.m_type == eEntry)
+      {
+        m_live[sequence] = Location{ segment->index, offset };
+        segment->live++;
+        if (sequence >= m_nextSequence) m_nextSequence = sequence + 1;
+      }
+      else
+      {
+        auto live = m_live.find(sequence);
+        if (live != m_live.end())
+        {
+          Segment& owner = segmentAt(live->second.segment);
+          if (owner.live) owner.live--;
+          m_live.erase(live);
+        }
+      }
+    offset += sizeof(header) + length;
+  }
+  if (torn)
+  {
+    // недописанный хвост будет перезаписан, не оставляем в нем мусора
+    std::memset(segment->data + offset, 0, segment->size - offset);
+    msync(segment->data, segment->size, MS_SYNC);
+  }
+  segment->end = segment->synced = offset;
+}
+
+MtOutbox::Segment& MtOutbox::segmentAt(uint64_t index) const
+{
+  return *m_segments.at(index - m_segments.front()->index);
+}
+
+void MtOutbox::removeSegments()
+{
+  while ((m_segments.size() > 1) && !m_segments.front()->live)
+  {
+    unlink(m_segments.front()->path.c_str());
+    m_unsynced.erase(
+      std::remove(m_unsynced.begin(), m_unsynced.end(), m_segments.front()),
+      m_unsynced.end()
+    );
+    m_segments.pop_front();
+  }
+}
@@ -0,0 +1,45 @@
+#include <stdexcept>
+#include <stdint.h>
+#include "iridium/Message.hpp"
+#include "iridium/PayloadFraming.hpp"
+
+using namespace Iridium;
+
+const size_t PayloadFraming::HeaderSize;
+const size_t PayloadFraming::MaxFrameLength;
+
+void PayloadFraming::pack(std::vector<char>& out, const char* data,
+                          size_t size)
+{
+  if (size > MaxFrameLength)
+    throw std::runtime_error("framed message too large");
+  out.reserve(out.size() + framedSize(size));
+  out.push_back(static_cast<char>((size >> 8) & 0xFF));
+  out.push_back(static_cast<char>(size & 0xFF));
+  out.insert(out.end(), data, data + size);
+}
+
+void PayloadFraming::split(const char* payload, size_t size,
+                           std::vector<std::vector<char> >& out)
+{
+  size_t offset = 0;
+  while (offset < size)
+  {
+    if (size - offset < HeaderSize)
+      throw std::runtime_error("truncated frame header");
+    size_t length =
+      (size_t(static_cast<uint8_t>(payload[offset])) << 8) |
+      static_cast<uint8_t>(payload[offset + 1]);
+    offset += HeaderSize;
+    if (size - offset < length) throw std::runtime_error("truncated frame");
+    out.push_back(std::vector<char>(payload + offset, payload + offset + length));
+    offset += length;
+  }
+}
+
+void PayloadFraming::split(const SbdDirectIp::MoMessage& message,
+                           std::vector<std::vector<char> >& out)
+{
+  std::vector<char> payload(message.payload());
+  split(payload.data(), payload.size(), out);
+}
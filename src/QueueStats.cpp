@@ -0,0 +1,114 @@
+#include "iridium/QueueStats.hpp"
+
+using namespace Iridium;
+
+const size_t QueueStats::Buckets;
+
+QueueStats::Snapshot::Snapshot():
+  depth(0), highWater(0), enqueued(0), dequeued(0), removed(0),
+  totalLatency(0), maxLatency(0)
+{
+  latency.fill(0);
+}
+
+QueueStats::Clock::duration QueueStats::Snapshot::bucketLimit(size_t bucket)
+{
+  if (bucket + 1 >= Buckets) return Clock::duration::max();
+  return std::chrono::milliseconds(uint64_t(1) << bucket);
+}
+
+QueueStats::Clock::duration QueueStats::Snapshot::percentile(double p) const
+{
+  uint64_t total = 0;
+  for (auto count: latency) total += count;
+  if (!total) return Clock::duration(0);
+  if (p < 0) p = 0;
+  if (p > 100) p = 100;
+  uint64_t rank = uint64_t(total * p / 100);
+  if (rank >= total) rank = total - 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < Buckets; i++)
+  {
+    seen += latency[i];
+    if (seen > rank) return bucketLimit(i);
+  }
+  return bucketLimit(Buckets - 1);
+}
+
+std::chrono::microseconds QueueStats::Snapshot::meanLatency() const
+{
+  uint64_t total = 0;
+  for (auto count: latency) total += count;
+  return std::chrono::microseconds(total ? totalLatency.count() / total : 0);
+}
+
+QueueStats::QueueStats():
+  m_depth(0), m_highWater(0), m_enqueued(0), m_dequeued(0), m_removed(0),
+  m_totalLatency(0), m_maxLatency(0)
+{
+  for (auto& count: m_latency) count.store(0, std::memory_order_relaxed);
+}
+
+void QueueStats::onEnqueue()
+{
+  m_enqueued.fetch_add(1, std::memory_order_relaxed);
+  size_t depth = m_depth.fetch_add(1, std::memory_order_relaxed) + 1;
+  size_t high = m_highWater.load(std::memory_order_relaxed);
+  while ((depth > high) &&
+         !m_highWater.compare_exchange_weak(high, depth,
+                                            std::memory_order_relaxed));
+}
+
+void QueueStats::onDequeue(Clock::duration waited)
+{
+  m_dequeued.fetch_add(1, std::memory_order_relaxed);
+  m_depth.fetch_sub(1, std::memory_order_relaxed);
+  uint64_t us = (waited.count() > 0) ?
+    std::chrono::duration_cast<std::chrono::microseconds>(waited).count() : 0;
+  uint64_t ms = us / 1000;
+  size_t bucket = 0;
+  while (ms && (bucket + 1 < Buckets))
+  {
+    ms >>= 1;
+    bucket++;
+  }
+  m_latency[bucket].fetch_add(1, std::memory_order_relaxed);
+  m_totalLatency.fetch_add(us, std::memory_order_relaxed);
+  uint64_t max = m_maxLatency.load(std::memory_order_relaxed);
+  while ((us > max) &&
+         !m_maxLatency.compare_exchange_weak(max, us,
+                                             std::memory_order_relaxed));
+}
+
+void QueueStats::onRemove(size_t count)
+{
+  m_removed.fetch_add(count, std::memory_order_relaxed);
+  m_depth.fetch_sub(count, std::memory_order_relaxed);
+}
+
+QueueStats::Snapshot QueueStats::snapshot() const
+{
+  Snapshot s;
+  s.depth = m_depth.load(std::memory_order_relaxed);
+  s.highWater = m_highWater.load(std::memory_order_relaxed);
+  s.enqueued = m_enqueued.load(std::memory_order_relaxed);
+  s.dequeued = m_dequeued.load(std::memory_order_relaxed);
+  s.removed = m_removed.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < Buckets; i++)
+    s.latency[i] = m_latency[i].load(std::memory_order_relaxed);
+  s.totalLatency = std::chrono::microseconds(
+    m_totalLatency.load(std::memory_order_relaxed)
+  );
+  s.maxLatency = std::chrono::microseconds(
+    m_maxLatency.load(std::memory_order_relaxed)
+  );
+  // глубина может кратковременно "уйти в минус" при гонке счетчиков
+  if (s.depth > s.enqueued) s.depth = 0;
+  return s;
+}
+
+void QueueStats::resetHighWater()
+{
+  m_highWater.store(m_depth.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+}
@@ -1,43 +1,123 @@
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <functional>
 #include <sstream>
+#include <stdexcept>
+#include <utility>
 #include <netinet/in.h>
 #include "iridium/Codec.hpp"
+#include "iridium/IEMtPriority.hpp"
 #include "iridium/SbdTransmitter.hpp"
 
 using namespace Iridium;
 
+namespace {
+
+std::shared_ptr<GatewayPool> singleGateway(const std::string& host,
+                                           const std::string& port)
+{
+  auto gateways = std::make_shared<GatewayPool>();
+  gateways->add(GatewayPool::Gateway(host, port));
+  return gateways;
+}
+
+}
+
 const unsigned short int SbdTransmitter::Heartbeat = 100;
 const unsigned short int SbdTransmitter::MaxDelay = 64;
+const std::chrono::milliseconds SbdTransmitter::DefaultAging(30000);
+const std::chrono::milliseconds SbdTransmitter::DefaultDeviceMinDelay(1000);
+const std::chrono::milliseconds SbdTransmitter::DefaultDeviceMaxDelay(300000);
+// с запасом на сообщения, отправленные до получения подтверждения
+const uint16_t SbdTransmitter::DefaultGatewayQueueLimit =
+  SbdDirectIp::IEMtConfirmationMsg::MaxQueueLength - 5;
+const std::chrono::milliseconds SbdTransmitter::DefaultGatewayQueueTimeout(1800000);
+const std::chrono::milliseconds SbdTransmitter::DefaultSpareMaxIdle(5000);
 
 SbdTransmitter::SbdTransmitter(boost::asio::io_service& service,
                                const std::string& host, const std::string& port):
+  SbdTransmitter(service, singleGateway(host, port))
+{
+}
+
+SbdTransmitter::SbdTransmitter(boost::asio::io_service& service,
+                               const std::shared_ptr<GatewayPool>& gateways):
   m_service(service),
   m_delayTimer(m_service),
-  m_host(host),
-  m_port(port),
+  m_deadlineTimer(m_service),
+  m_session(0),
+  m_gateways(gateways),
+  m_gateway(GatewayPool::None),
+  m_failedGateway(GatewayPool::None),
   m_socket(m_service),
   m_resolver(m_service),
+  m_connectStagger(TcpConnector::DefaultStagger),
+  m_spareResolver(m_service),
+  m_spareTimer(m_service),
+  m_spareGateway(GatewayPool::None),
+  m_spareMaxIdle(DefaultSpareMaxIdle),
+  m_warming(false),
+  m_spareAttempt(0),
+  m_prewarmed(false),
   m_running(false),
   m_shutdown(false),
   m_errDelay(1),
+  m_messageQueue(SbdDirectIp::IEMtPriority::MinPriority -
+                 SbdDirectIp::IEMtPriority::MaxPriority + 1, DefaultAging),
+  m_queueStats(std::make_shared<QueueStats>()),
   m_prevState(eNotConnected),
   m_state(eNotConnected),
+  m_deviceMinDelay(DefaultDeviceMinDelay),
+  m_deviceMaxDelay(DefaultDeviceMaxDelay),
+  m_gatewayQueueLimit(DefaultGatewayQueueLimit),
+  m_gatewayQueueTimeout(DefaultGatewayQueueTimeout),
+  m_deviceRate(0),
+  m_deviceBurst(1),
+  m_capacity(0),
+  m_overflowPolicy(eBlock),
+  m_pending(0),
+  m_highWaterMark(0),
+  m_outboxRecovered(false),
+  m_commitTimer(m_service),
   m_confirmationLength(0)
 {
+  if (!m_gateways || !m_gateways->size())
+    throw std::invalid_argument("no DirectIP gateways");
+  m_messageQueue.setStats(m_queueStats);
+  typedef SbdDirectIp::IEMtConfirmationMsg C;
+  // повтор заведомо бесполезен
+  m_retryPolicies[C::eInvalidImei] = eDrop;
+  m_retryPolicies[C::eUnknownImei] = eDrop;
+  m_retryPolicies[C::ePayloadTooLarge] = eDrop;
+  m_retryPolicies[C::eNoPayload] = eDrop;
+  m_retryPolicies[C::eProtocolError] = eDrop;
+  m_retryPolicies[C::eMtmsnOutOfRange] = eDrop;
+  // неисправность устройства
+  m_retryPolicies[C::eQueueFull] = eDelayDevice;
+  m_retryPolicies[C::eRingAlertsDisabled] = eDelayDevice;
+  m_retryPolicies[C::eImeiNotAttached] = eDelayDevice;
+  // неисправность шлюза
+  m_retryPolicies[C::eNoResources] = eRetry;
+  m_retryPolicies[C::eIpAddressRejected] = eRetry;
 }
 
 SbdTransmitter::~SbdTransmitter()
 {
   stop(true);
+  // неотправленные сообщения остаются в журнале исходящих до следующего
+  // запуска, "обещания" получают итог eDropped
+  m_outbox.reset();
+  dropMessages();
 }
 
 void SbdTransmitter::start()
 {
   if (m_running) return;
+  recoverOutbox();
   m_running = true;
   m_shutdown = false;
+  scheduleCommit();
   auto thread = std::make_shared<std::thread>(
     std::bind(&SbdTransmitter::worker, this)
   );
@@ -50,36 +130,692 @@ void SbdTransmitter::stop(bool woexcept)
   m_shutdown = true;
   try
   {
-    m_delayTimer.cancel();
+    std::lock_guard<std::mutex> lock(m_commitMutex);
+    (void)lock;
+    m_commitTimer.cancel();
   }
   catch (...)
   {
     if (!woexcept) throw;
   }
+  if (m_service.get_executor().running_in_this_thread()) cancelIo();
+  else
+  {
+    std::promise<void> cancelled;
+    std::future<void> done = cancelled.get_future();
+    HandlerGuard pending;
+    HandlerGuard::Weak guard = pending.weak();
+    m_service.post([this, guard, &cancelled]() {
+      HandlerGuard::run(guard, [this, &cancelled]() {
+        cancelIo();
+        cancelled.set_value();
+      });
+    });
+    while ((done.wait_for(std::chrono::milliseconds(Heartbeat)) ==
+            std::future_status::timeout) && !m_service.stopped());
+    // остановленный цикл обработчик уже не выполнит, ввод/вывод
+    // прерывается здесь
+    pending.close();
+    if (done.wait_for(std::chrono::seconds(0)) == std::future_status::timeout)
+      cancelIo();
+  }
   try
   {
-    if (m_socket.is_open()) m_socket.cancel();
+    m_thread->join();
   }
   catch (...)
   {
     if (!woexcept) throw;
   }
-  try
+  // прерванное сообщение будет отправлено после перезапуска
+  if (m_sending.tracker)
+    m_messageQueue.unget(m_sending, m_sending.level, m_sending.stamp);
+  m_sending = Outgoing();
+  commitOutbox();
+}
+
+SbdTransmitter::TransmitHandle SbdTransmitter::post(
+  const SbdDirectIp::MtMessage& message,
+  const TransmitCallback& callback
+)
+{
+  Outgoing job, evicted;
+  job.level = priorityLevel(message);
+  bool dropped = false;
   {
-    m_thread->join();
+    std::unique_lock<std::mutex> lock(m_capacityMutex);
+    if (m_capacity && (m_pending >= m_capacity))
+    {
+      switch (m_overflowPolicy)
+      {
+        case eBlock:
+          m_capacityCond.wait(lock, [this]() {
+            return !m_capacity || (m_pending < m_capacity);
+          });
+          break;
+        case eReject:
+          throw std::runtime_error("transmit queue is full");
+        case eDropOldest:
+          dropped = !m_messageQueue.evictOldest(evicted);
+          break;
+        case eDropLowestPriority:
+          dropped = !m_messageQueue.evictLowest(job.level, evicted);
+          break;
+      }
+    }
+    // новое сообщение занимает место вытесненного, отброшенное не
+    // учитывается вовсе
+    if (!dropped && !evicted.tracker) m_pending++;
+    if (m_pending > m_highWaterMark) m_highWaterMark = m_pending;
   }
-  catch (...)
   {
-    if (!woexcept) throw;
+    // сообщение сериализуется один раз, копия нужна из-за неконстантного
+    // MtMessage::serialize()
+    SbdDirectIp::MtMessage copy(message);
+    job.frame = std::make_shared<const std::vector<char> >(copy.serialize());
   }
+  job.tracker = std::make_shared<Outgoing::Tracker>();
+  job.tracker->callback = callback;
+  job.tracker->report.messageId = message.messageId();
+  job.tracker->report.imei = message.imei();
+  job.tracker->report.posted = job.stamp = Clock::now();
+  TransmitHandle handle(job.tracker->promise.get_future());
+  complete(evicted, TransmitReport::eDropped, false);
+  if (dropped)
+  {
+    complete(job, TransmitReport::eDropped, false);
+    return handle;
+  }
+  if (m_outbox)
+  {
+    try
+    {
+      job.sequence = m_outbox->append(*job.frame);
+    }
+    catch (std::runtime_error& e)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_capacityMutex);
+        (void)lock;
+        m_pending--;
+      }
+      m_capacityCond.notify_one();
+      throw;
+    }
+  }
+  size_t level = job.level;
+  Clock::time_point stamp = job.stamp;
+  m_messageQueue.put(std::move(job), level, stamp);
+  m_messageQueue.notify_one();
+  return handle;
+}
+
+void SbdTransmitter::setOutbox(const std::shared_ptr<MtOutbox>& outbox)
+{
+  if (m_running)
+    throw std::runtime_error("can't change outbox of running transmitter");
+  m_outbox = outbox;
+  m_outboxRecovered = false;
 }
 
-void SbdTransmitter::post(const SbdDirectIp::MtMessage& message)
+void SbdTransmitter::recoverOutbox()
 {
-  m_messageQueue.put(message);
+  if (!m_outbox || m_outboxRecovered) return;
+  if (!m_outbox->isOpen()) m_outbox->open();
+  m_outboxRecovered = true;
+  std::vector<MtOutbox::Record> records;
+  m_outbox->recover(records);
+  for (auto& record: records)
+  {
+    Outgoing job;
+    job.sequence = record.sequence;
+    SbdDirectIp::MtMessage message;
+    SbdDirectIp::MessageHeader header;
+    try
+    {
+      if (record.frame.size() < sizeof(header))
+        throw std::runtime_error("frame too short");
+      std::memcpy(&header, record.frame.data(), sizeof(header));
+      header.m_length = ntohs(header.m_length);
+      if ((header.m_proto != SbdDirectIp::SbdProtoNumber) ||
+          (record.frame.size() != sizeof(header) + header.m_length))
+        throw std::runtime_error("bad frame header");
+      SbdDirectIp::Codec::parse(record.frame.data() + sizeof(header),
+                                header.m_length, message);
+    }
+    catch (std::runtime_error& e)
+    {
+      std::ostringstream err;
+      err << "outbox record " << record.sequence << " discarded: " << e.what();
+      m_emitOnError(err.str());
+      m_outbox->acknowledge(record.sequence);
+      continue;
+    }
+    job.level = priorityLevel(message);
+    job.frame = std::make_shared<const std::vector<char> >(std::move(record.frame));
+    job.tracker = std::make_shared<Outgoing::Tracker>();
+    job.tracker->report.messageId = message.messageId();
+    job.tracker->report.imei = message.imei();
+    job.tracker->report.posted = job.stamp = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(m_capacityMutex);
+      (void)lock;
+      m_pending++;
+      if (m_pending > m_highWaterMark) m_highWaterMark = m_pending;
+    }
+    size_t level = job.level;
+    Clock::time_point stamp = job.stamp;
+    m_messageQueue.put(std::move(job), level, stamp);
+  }
   m_messageQueue.notify_one();
 }
 
+void SbdTransmitter::commitOutbox()
+{
+  if (!m_outbox) return;
+  try
+  {
+    m_outbox->commit();
+  }
+  catch (std::runtime_error& e)
+  {
+    m_emitOnError(e.what());
+  }
+}
+
+void SbdTransmitter::scheduleCommit()
+{
+  if (!m_outbox) return;
+  std::lock_guard<std::mutex> lock(m_commitMutex);
+  (void)lock;
+  if (m_shutdown) return;
+  m_commitTimer.expires_from_now(std::chrono::milliseconds(Heartbeat));
+  m_commitTimer.async_wait([this](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) return;
+    if (m_shutdown) return;
+    // групповой сброс журнала исходящих на диск, в том числе во время
+    // сессий
+    commitOutbox();
+    scheduleCommit();
+  });
+}
+
+void SbdTransmitter::setCapacity(size_t capacity, EOverflowPolicy policy)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_capacityMutex);
+    (void)lock;
+    m_capacity = capacity;
+    m_overflowPolicy = policy;
+  }
+  m_capacityCond.notify_all();
+}
+
+size_t SbdTransmitter::pendingMessages() const
+{
+  std::lock_guard<std::mutex> lock(m_capacityMutex);
+  (void)lock;
+  return m_pending;
+}
+
+size_t SbdTransmitter::highWaterMark() const
+{
+  std::lock_guard<std::mutex> lock(m_capacityMutex);
+  (void)lock;
+  return m_highWaterMark;
+}
+
+void SbdTransmitter::dropMessages()
+{
+  std::vector<Outgoing> removed;
+  m_messageQueue.clear(removed);
+  {
+    std::lock_guard<std::mutex> lock(m_devicesMutex);
+    (void)lock;
+    size_t queued = removed.size();
+    for (auto& device: m_devices)
+    {
+      removed.insert(removed.end(), device.second.deferred.begin(),
+                     device.second.deferred.end());
+      device.second.deferred.clear();
+    }
+    // отложенные сообщения в статистике очереди считаются ожидающими
+    m_queueStats->onRemove(removed.size() - queued);
+  }
+  for (auto& job: removed) complete(job, TransmitReport::eDropped);
+}
+
+size_t SbdTransmitter::deferredDepth() const
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  size_t depth = 0;
+  for (auto& device: m_devices) depth += device.second.deferred.size();
+  return depth;
+}
+
+void SbdTransmitter::setRetryPolicy(
+  SbdDirectIp::IEMtConfirmationMsg::EMsgStatus status,
+  ERetryPolicy policy
+)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  m_retryPolicies[status] = policy;
+}
+
+void SbdTransmitter::setDeviceBackoff(std::chrono::milliseconds const& min,
+                                      std::chrono::milliseconds const& max)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  m_deviceMinDelay = min;
+  m_deviceMaxDelay = (max < min) ? min : max;
+}
+
+void SbdTransmitter::setRateLimit(double rate, unsigned int burst)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  m_rateLimit.configure(rate, burst);
+}
+
+void SbdTransmitter::setDeviceRateLimit(double rate, unsigned int burst)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  m_deviceRate = rate;
+  m_deviceBurst = burst;
+  if (rate <= 0)
+    m_deviceRateLimits.clear();
+    else
+      for (auto& limit: m_deviceRateLimits)
+        limit.second.configure(rate, burst);
+}
+
+void SbdTransmitter::setGatewayQueueLimit(uint16_t limit,
+                                          std::chrono::milliseconds const& timeout)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  m_gatewayQueueLimit = limit;
+  m_gatewayQueueTimeout = timeout;
+}
+
+void SbdTransmitter::deviceCheckedIn(const std::string& imei)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  auto device = m_devices.find(imei);
+  if ((device == m_devices.end()) || !device->second.gatewayQueue) return;
+  // сообщения будут возвращены в очередь в releaseDevices()
+  device->second.gatewayQueue = 0;
+  device->second.until = Clock::now();
+}
+
+void SbdTransmitter::resetDevice(const std::string& imei, uint16_t queuePosition)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  bool full = m_gatewayQueueLimit && (queuePosition >= m_gatewayQueueLimit);
+  auto device = m_devices.find(imei);
+  if (device == m_devices.end())
+  {
+    if (!full) return;
+    device = m_devices.insert(std::make_pair(imei, Device())).first;
+  }
+  if (!full && device->second.deferred.empty())
+  {
+    m_devices.erase(device);
+    return;
+  }
+  device->second.delay = std::chrono::milliseconds(0);
+  device->second.gatewayQueue = full ? queuePosition : 0;
+  device->second.until = full ? Clock::now() + m_gatewayQueueTimeout :
+                                Clock::now();
+}
+
+SbdTransmitter::ERetryPolicy SbdTransmitter::retryPolicy(int16_t status)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  auto i = m_retryPolicies.find(status);
+  return (i == m_retryPolicies.end()) ? eRetry : i->second;
+}
+
+bool SbdTransmitter::nextMessage()
+{
+  while (true)
+  {
+    // откладывание сообщения не учитывается в статистике очереди
+    Outgoing job = m_messageQueue.take();
+    if (!job.tracker) return false;
+    const std::string& imei = job.tracker->report.imei;
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_devicesMutex);
+    (void)lock;
+    auto device = m_devices.find(imei);
+    if ((device != m_devices.end()) && (device->second.until > now))
+    {
+      device->second.deferred.push_back(job);
+      continue;
+    }
+    if (m_deviceRate > 0)
+    {
+      auto limit = m_deviceRateLimits.find(imei);
+      if (limit == m_deviceRateLimits.end())
+        limit = m_deviceRateLimits.insert(
+          std::make_pair(imei, TokenBucket(m_deviceRate, m_deviceBurst))
+        ).first;
+      Clock::duration wait = limit->second.delay(now);
+      if (wait.count() > 0)
+      {
+        // сообщение ожидает темпа среди отложенных сообщений устройства,
+        // задержка устройства при этом не меняется
+        Device& paced = m_devices[imei];
+        paced.until = now + wait;
+        paced.deferred.push_back(job);
+        continue;
+      }
+      limit->second.consume(now);
+    }
+    m_rateLimit.consume(now);
+    m_queueStats->onDequeue(now - job.stamp);
+    m_sending = job;
+    return true;
+  }
+}
+
+void SbdTransmitter::releaseDevices()
+{
+  Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  for (auto device = m_devices.begin(); device != m_devices.end();)
+  {
+    if (device->second.until > now)
+    {
+      ++device;
+      continue;
+    }
+    if (device->second.deferred.empty())
+    {
+      // после снятия задержки прошел еще один ее интервал без новых
+      // неудач: следующая неудача начнет отсчет с наименьшей задержки
+      if (device->second.until + device->second.delay <= now)
+        device = m_devices.erase(device);
+        else ++device;
+      continue;
+    }
+    // в обратном порядке, чтобы сохранить очередность сообщений
+    for (auto i = device->second.deferred.rbegin();
+         i != device->second.deferred.rend(); ++i)
+      m_messageQueue.restore(*i, i->level, i->stamp);
+    device->second.deferred.clear();
+    // устройство, отложенное только из-за темпа
+    if (device->second.delay.count() == 0)
+      device = m_devices.erase(device);
+      else ++device;
+  }
+  for (auto limit = m_deviceRateLimits.begin();
+       limit != m_deviceRateLimits.end();)
+  {
+    if (limit->second.full(now))
+      limit = m_deviceRateLimits.erase(limit);
+      else ++limit;
+  }
+}
+
+void SbdTransmitter::deferDevice(Outgoing& job, int16_t status)
+{
+  std::lock_guard<std::mutex> lock(m_devicesMutex);
+  (void)lock;
+  Device& device = m_devices[job.tracker->report.imei];
+  // очередь на шлюзе опустошит только сеанс связи устройства
+  if (status == SbdDirectIp::IEMtConfirmationMsg::eQueueFull)
+    device.gatewayQueue = SbdDirectIp::IEMtConfirmationMsg::MaxQueueLength;
+  device.delay = (device.delay.count() == 0) ? m_deviceMinDelay :
+                                               device.delay * 2;
+  if (device.delay > m_deviceMaxDelay) device.delay = m_deviceMaxDelay;
+  device.until = Clock::now() + device.delay;
+  device.deferred.insert(device.deferred.begin(), job);
+  // сообщение снова ожидает, как при возврате в очередь
+  m_queueStats->onEnqueue();
+  job = Outgoing();
+}
+
+void SbdTransmitter::complete(Outgoing& job, TransmitReport::EOutcome outcome,
+                              bool counted)
+{
+  if (!job.tracker) return;
+  // задание освобождается до вызова обработчиков: обработчик может
+  // остановить передатчик, который возвращает текущее задание в очередь
+  std::shared_ptr<Outgoing::Tracker> tracker;
+  tracker.swap(job.tracker);
+  uint64_t sequence = job.sequence;
+  job.sequence = 0;
+  TransmitReport& report = tracker->report;
+  report.outcome = outcome;
+  report.completed = Clock::now();
+  tracker->promise.set_value(report);
+  if (tracker->callback) tracker->callback(report);
+  m_emitOnTransmitReport(report);
+  if (m_outbox && sequence)
+  {
+    try
+    {
+      m_outbox->acknowledge(sequence);
+    }
+    catch (std::runtime_error& e)
+    {
+      std::ostringstream err;
+      err << "outbox acknowledge error: " << e.what();
+      m_emitOnError(err.str());
+    }
+  }
+  if (!counted) return;
+  {
+    std::lock_guard<std::mutex> lock(m_capacityMutex);
+    (void)lock;
+    if (m_pending) m_pending--;
+  }
+  m_capacityCond.notify_one();
+}
+
+size_t SbdTransmitter::queueDepth(uint16_t priority) const
+{
+  if ((priority < SbdDirectIp::IEMtPriority::MaxPriority) ||
+      (priority > SbdDirectIp::IEMtPriority::MinPriority))
+    return 0;
+  return m_messageQueue.size(priority - SbdDirectIp::IEMtPriority::MaxPriority);
+}
+
+size_t SbdTransmitter::priorityLevel(const SbdDirectIp::MtMessage& message)
+{
+  uint16_t priority = message.priority();
+  // Iridium SBD service developer guide, p. 7.2.3: priority level is used
+  // only with "high priority" disposition flag
+  if (!message.flags().highPriority ||
+      (priority < SbdDirectIp::IEMtPriority::MaxPriority) ||
+      (priority > SbdDirectIp::IEMtPriority::MinPriority))
+    priority = SbdDirectIp::IEMtPriority::MinPriority;
+  return priority - SbdDirectIp::IEMtPriority::MaxPriority;
+}
+
+void SbdTransmitter::nextPhase(Clock::duration* elapsed,
+                               std::chrono::milliseconds limit)
+{
+  Clock::time_point now = Clock::now();
+  if (elapsed) *elapsed = now - m_phaseStart;
+  m_phaseStart = now;
+  if (!limit.count())
+  {
+    m_deadlineTimer.cancel();
+    return;
+  }
+  State phase = m_state;
+  unsigned long session = m_session;
+  m_deadlineTimer.expires_from_now(limit);
+  m_deadlineTimer.async_wait(
+    [this, phase, session, limit](const boost::system::error_code& ec) {
+      if (ec == boost::asio::error::operation_aborted) return;
+      if ((session != m_session) || m_shutdown) return;
+      // прием подтверждения может занимать несколько чтений
+      bool same = (m_state == phase) ||
+                  ((phase == eReceivingHeader) &&
+                   (m_state == eReceivingConfirmation));
+      if (!same) return;
+      std::ostringstream err;
+      switch (phase)
+      {
+        case eResolving:
+          err << "resolve";
+          break;
+        case eConnecting:
+          err << "connection";
+          break;
+        case eSending:
+          err << "transmit";
+          break;
+        default:
+          err << "receive confirmation";
+          break;
+      }
+      err << " timeout (" << limit.count() << " ms)";
+      m_emitOnError(err.str());
+      boost::system::error_code error;
+      m_resolver.cancel();
+      // прерванные операции завершатся с operation_aborted
+      if ((phase == eConnecting) && m_connector) m_connector->cancel();
+      else if (m_socket.is_open()) m_socket.cancel(error);
+      m_prevState = m_state;
+      m_state = eError;
+      StateMachine();
+  });
+}
+
+void SbdTransmitter::prewarm()
+{
+  if (!m_spareMaxIdle.count() || (m_gateway == GatewayPool::None) ||
+      !m_messageQueue.size())
+    return;
+  std::lock_guard<std::mutex> lock(m_spareMutex);
+  (void)lock;
+  if (m_spare || m_warming || m_shutdown) return;
+  size_t index = m_gateway;
+  unsigned long attempt = ++m_spareAttempt;
+  m_warming = true;
+  spareDeadline(attempt, m_timeouts.resolve);
+  m_spareResolver.async_resolve(
+    boost::asio::ip::tcp::resolver::query(m_host, m_port),
+    [this, index, attempt](const boost::system::error_code& ec,
+                           boost::asio::ip::tcp::resolver::iterator i) {
+      // прерванную попытку завершил прервавший ее
+      if (ec == boost::asio::error::operation_aborted) return;
+      std::lock_guard<std::mutex> lock(m_spareMutex);
+      (void)lock;
+      if (attempt != m_spareAttempt) return;
+      if (ec || m_shutdown)
+      {
+        m_spareTimer.cancel();
+        m_warming = false;
+        return;
+      }
+      spareDeadline(attempt, m_timeouts.connect);
+      m_spareConnector = TcpConnector::create(m_service);
+      m_spareConnector->connect(i, m_connectStagger,
+        [this, index, attempt](const boost::system::error_code& ec,
+                               TcpConnector::SocketPtr socket) {
+          // ошибки запасного соединения не учитываются: сессия, которой
+          // оно понадобится, установит соединение обычным образом
+          if (ec == boost::asio::error::operation_aborted) return;
+          std::lock_guard<std::mutex> lock(m_spareMutex);
+          (void)lock;
+          if (attempt != m_spareAttempt) return;
+          m_spareTimer.cancel();
+          m_spareConnector.reset();
+          m_warming = false;
+          if (ec || m_shutdown) return;
+          m_spare = socket;
+          m_spareGateway = index;
+          m_spareStamp = Clock::now();
+      });
+  });
+}
+
+void SbdTransmitter::spareDeadline(unsigned long attempt,
+                                   std::chrono::milliseconds limit)
+{
+  if (!limit.count())
+  {
+    m_spareTimer.cancel();
+    return;
+  }
+  m_spareTimer.expires_from_now(limit);
+  m_spareTimer.async_wait([this, attempt](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) return;
+    std::lock_guard<std::mutex> lock(m_spareMutex);
+    (void)lock;
+    if ((attempt != m_spareAttempt) || !m_warming) return;
+    // зависшая попытка не должна навсегда запрещать запасное соединение
+    m_spareAttempt++;
+    m_spareResolver.cancel();
+    if (m_spareConnector) m_spareConnector->cancel();
+    m_spareConnector.reset();
+    m_warming = false;
+  });
+}
+
+bool SbdTransmitter::takeSpare()
+{
+  TcpConnector::SocketPtr spare;
+  bool fresh;
+  {
+    std::lock_guard<std::mutex> lock(m_spareMutex);
+    (void)lock;
+    if (!m_spare) return false;
+    spare.swap(m_spare);
+    fresh = (m_spareGateway == m_gateway) &&
+            (Clock::now() - m_spareStamp <= m_spareMaxIdle);
+  }
+  // запасное соединение больше не принадлежит циклу ввода/вывода, операций
+  // над ним нет
+  boost::system::error_code ec;
+  if (!fresh)
+  {
+    spare->close(ec);
+    return false;
+  }
+  m_socket.close(ec);
+  m_socket = std::move(*spare);
+  return true;
+}
+
+void SbdTransmitter::dropSpare()
+{
+  boost::system::error_code ec;
+  std::lock_guard<std::mutex> lock(m_spareMutex);
+  (void)lock;
+  m_spareAttempt++;
+  m_spareTimer.cancel();
+  m_spareResolver.cancel();
+  if (m_spareConnector) m_spareConnector->cancel();
+  m_spareConnector.reset();
+  m_warming = false;
+  if (m_spare) m_spare->close(ec);
+  m_spare.reset();
+}
+
+void SbdTransmitter::cancelIo()
+{
+  boost::system::error_code ec;
+  m_delayTimer.cancel(ec);
+  m_deadlineTimer.cancel(ec);
+  if (m_socket.is_open()) m_socket.cancel(ec);
+  if (m_connector) m_connector->cancel();
+  dropSpare();
+}
+
 void SbdTransmitter::worker()
 {
   m_errDelay = 1;
@@ -89,15 +825,38 @@ void SbdTransmitter::worker()
   {
     if (m_state == eNotConnected)
       {
-        if (m_messageQueue.wait_for(std::chrono::milliseconds(Heartbeat)))
-          continue;
+        bool timeout = m_messageQueue.wait_for(std::chrono::milliseconds(Heartbeat));
+        releaseDevices();
+        if (timeout) continue;
+        {
+          Clock::duration wait;
+          {
+            std::lock_guard<std::mutex> lock(m_devicesMutex);
+            (void)lock;
+            wait = m_rateLimit.delay(Clock::now());
+          }
+          if (wait.count() > 0)
+          {
+            // сообщения ожидают в очереди
+            std::this_thread::sleep_for(
+              std::min<Clock::duration>(wait, std::chrono::milliseconds(Heartbeat))
+            );
+            continue;
+          }
+        }
+        if (!nextMessage()) continue;
         m_prevState = m_state;
         m_state = eResolving;
         StateMachine();
       }
       else
       {
-        std::this_thread::sleep_for(std::chrono::milliseconds(Heartbeat));
+        // следующая сессия начинается сразу по завершении текущей
+        std::unique_lock<std::mutex> lock(m_stateMutex);
+        m_stateCond.wait_for(lock, std::chrono::milliseconds(Heartbeat),
+                             [this]() {
+          return (m_state == eNotConnected) || m_shutdown;
+        });
       }
   }
   m_sentinel.reset();
@@ -137,6 +896,11 @@ void SbdTransmitter::StateMachine()
       m_buf.reset();
       m_confirmationLength = 0;
       m_sentinel.reset();
+      {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        (void)lock;
+      }
+      m_stateCond.notify_one();
       break;
     case eResolving:
       // Iridium SBD service developer guide, p. 7.2.1 "MT Vendor Client Requirements"
@@ -145,6 +909,32 @@ void SbdTransmitter::StateMachine()
         auto work = std::make_shared<boost::asio::io_service::work>(m_service);
         m_sentinel.swap(work);
       }
+      m_session++;
+      m_sending.tracker->report.timing = TransmitReport::Timing();
+      m_gateway = m_gateways->select(m_failedGateway);
+      if (m_gateway == GatewayPool::None)
+      {
+        m_emitOnError("no DirectIP gateway available");
+        m_prevState = m_state;
+        m_state = eError;
+        StateMachine();
+        break;
+      }
+      {
+        GatewayPool::Gateway gateway = m_gateways->gateway(m_gateway);
+        m_host = gateway.host;
+        m_port = gateway.port;
+        m_sending.tracker->report.gateway = m_host + ":" + m_port;
+      }
+      nextPhase(nullptr, m_timeouts.resolve);
+      m_prewarmed = takeSpare();
+      if (m_prewarmed)
+      {
+        m_prevState = m_state;
+        m_state = eSending;
+        StateMachine();
+        break;
+      }
       m_resolver.async_resolve(boost::asio::ip::tcp::resolver::query(m_host, m_port),
                                [this](const boost::system::error_code& ec,
                                       boost::asio::ip::tcp::resolver::iterator i) {
@@ -169,12 +959,15 @@ void SbdTransmitter::StateMachine()
       });
       break;
     case eConnecting:
-      boost::asio::async_connect(m_socket, m_rIterator,
-                                 [this](const boost::system::error_code& ec,
-                                        boost::asio::ip::tcp::resolver::iterator i) {
+      nextPhase(&m_sending.tracker->report.timing.resolve, m_timeouts.connect);
+      m_connector = TcpConnector::create(m_service);
+      m_connector->connect(m_rIterator, m_connectStagger,
+                           [this](const boost::system::error_code& ec,
+                                  TcpConnector::SocketPtr socket) {
         if (ec == boost::asio::error::operation_aborted) return;
+        m_connector.reset();
         if ((m_state != eConnecting) || m_shutdown) return;
-        if (ec || (i == boost::asio::ip::tcp::resolver::iterator()))
+        if (ec)
         {
           std::ostringstream err;
           err << "connection error: " << ec.message();
@@ -184,6 +977,9 @@ void SbdTransmitter::StateMachine()
           StateMachine();
           return;
         }
+        boost::system::error_code error;
+        m_socket.close(error);
+        m_socket = std::move(*socket);
         m_prevState = m_state;
         m_state = eSending;
         StateMachine();
@@ -191,19 +987,16 @@ void SbdTransmitter::StateMachine()
       break;
     case eSending:
       // Step B.
-      m_sendingMessage = m_messageQueue.get();
-      m_buf = std::make_shared<boost::asio::streambuf>();
-      {
-        std::vector<char> buf(std::move(m_sendingMessage.serialize()));
-        std::ostream os(m_buf.get());
-        os.write(buf.data(), buf.size());
-      }
+      nextPhase(&m_sending.tracker->report.timing.connect, m_timeouts.write);
+      m_sending.tracker->report.attempts++;
+      m_sending.tracker->report.sent = Clock::now();
+      // кадр неизменен и принадлежит m_sending до получения итога, повторные
+      // попытки отправляют те же байты
       boost::asio::async_write(
-        m_socket, *m_buf.get(),
+        m_socket, boost::asio::buffer(*m_sending.frame),
         [this](const boost::system::error_code& ec, std::size_t bytes) {
           (void)bytes;
           if (ec == boost::asio::error::operation_aborted) return;
-          m_buf.reset();
           if ((m_state != eSending) || m_shutdown) return;
           if (ec)
           {
@@ -221,6 +1014,10 @@ void SbdTransmitter::StateMachine()
       });
       break;
     case eReceivingHeader:
+      nextPhase(&m_sending.tracker->report.timing.write, m_timeouts.confirmation);
+      // соединение для следующего сообщения устанавливается, пока шлюз
+      // обрабатывает текущее
+      prewarm();
       m_buf.reset();
       m_buf = std::make_shared<boost::asio::streambuf>();
       m_socket.async_read_some(
@@ -296,6 +1093,8 @@ void SbdTransmitter::StateMachine()
         }
       break;
     case eProcessingConfirmation:
+      nextPhase(&m_sending.tracker->report.timing.confirmation,
+                std::chrono::milliseconds(0));
       {
         std::string buf;
         buf.assign(boost::asio::buffers_begin(m_buf->data()),
@@ -332,13 +1131,33 @@ void SbdTransmitter::StateMachine()
         }
         m_buf->consume(m_confirmationLength);
         m_emitOnTransmitResult(confirmation.status());
+        TransmitReport& report = m_sending.tracker->report;
+        report.autoRef = confirmation.autoRef();
+        report.status = confirmation.status();
+        report.queuePosition = (confirmation.status() > 0) ?
+          confirmation.status() : 0;
         if (confirmation.status() < 0)
-        {
-          m_prevState = m_state;
-          m_state = eError;
-          StateMachine();
-          return;
-        }
+          {
+            switch (retryPolicy(confirmation.status()))
+            {
+              case eRetry:
+                m_prevState = m_state;
+                m_state = eError;
+                StateMachine();
+                return;
+              case eDelayDevice:
+                deferDevice(m_sending, confirmation.status());
+                break;
+              case eDrop:
+                complete(m_sending, TransmitReport::eRejected);
+                break;
+            }
+          }
+          else
+          {
+            resetDevice(report.imei, report.queuePosition);
+            complete(m_sending, TransmitReport::eConfirmed);
+          }
       }
       if (m_buf->size() > 0)
       {
@@ -347,26 +1166,55 @@ void SbdTransmitter::StateMachine()
         err << m_buf->size() << " unexpected bytes received";
         m_emitOnError(err.str());
       }
+      m_gateways->success(m_gateway);
+      m_gateway = m_failedGateway = GatewayPool::None;
       m_errDelay = 1;
       m_prevState = m_state;
       m_state = eSuccess;
       StateMachine();
       break;
     case eError:
-      if (m_prevState >= eSending) m_messageQueue.unget(m_sendingMessage);
+      m_deadlineTimer.cancel();
+      if (m_sending.tracker)
+        m_messageQueue.unget(m_sending, m_sending.level, m_sending.stamp);
+      m_sending = Outgoing();
       if (m_prevState > eConnecting) closeSocket();
-      m_delayTimer.expires_from_now(std::chrono::milliseconds(Heartbeat * m_errDelay));
-      m_delayTimer.async_wait([this](const boost::system::error_code& ec) {
-        if (ec == boost::asio::error::operation_aborted) return;
-        if (m_errDelay < MaxDelay) m_errDelay *= 2;
-        m_prevState = m_state;
-        m_state = eNotConnected;
-        StateMachine();
-      });
+      if (m_gateway != GatewayPool::None)
+      {
+        // запасное соединение могло быть закрыто шлюзом за время простоя,
+        // это не считается неисправностью шлюза
+        if (!m_prewarmed)
+        {
+          m_gateways->failure(m_gateway);
+          m_failedGateway = m_gateway;
+        }
+        m_gateway = GatewayPool::None;
+      }
+      {
+        // есть другой доступный шлюз или не удалось запасное соединение --
+        // повтор без задержки
+        bool failover = m_prewarmed ||
+                        ((m_failedGateway != GatewayPool::None) &&
+                         m_gateways->available(m_failedGateway));
+        m_prewarmed = false;
+        m_delayTimer.expires_from_now(
+          std::chrono::milliseconds(failover ? 0 : Heartbeat * m_errDelay)
+        );
+        m_delayTimer.async_wait([this, failover](const boost::system::error_code& ec) {
+          if (ec == boost::asio::error::operation_aborted) return;
+          if (!failover && (m_errDelay < MaxDelay)) m_errDelay *= 2;
+          m_prevState = m_state;
+          m_state = eNotConnected;
+          StateMachine();
+        });
+      }
       break;
     case eSuccess:
       // Step C.
       closeSocket();
+      // итог отправки уже сообщен или сообщение отложено
+      m_sending = Outgoing();
+      m_prewarmed = false;
       m_prevState = m_state;
       m_state = eNotConnected;
       StateMachine();
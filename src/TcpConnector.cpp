@@ -0,0 +1,116 @@
+#include "iridium/TcpConnector.hpp"
+
+using namespace Iridium;
+
+const std::chrono::milliseconds TcpConnector::DefaultStagger(250);
+
+std::shared_ptr<TcpConnector> TcpConnector::create(boost::asio::io_service& service)
+{
+  return std::shared_ptr<TcpConnector>(new TcpConnector(service));
+}
+
+TcpConnector::TcpConnector(boost::asio::io_service& service):
+  m_service(service),
+  m_staggerTimer(service),
+  m_stagger(DefaultStagger),
+  m_next(0),
+  m_active(0)
+{
+}
+
+void TcpConnector::connect(boost::asio::ip::tcp::resolver::iterator endpoints,
+                           std::chrono::milliseconds const& stagger,
+                           const Handler& handler)
+{
+  m_handler = handler;
+  m_stagger = stagger;
+  m_next = m_active = 0;
+  m_sockets.clear();
+  m_lastError = boost::asio::error::host_not_found;
+  // чередование семейств адресов, RFC 8305 p. 4
+  std::vector<boost::asio::ip::tcp::endpoint> primary, secondary;
+  bool v6 = true;
+  for (auto i = endpoints; i != boost::asio::ip::tcp::resolver::iterator(); ++i)
+  {
+    boost::asio::ip::tcp::endpoint endpoint = *i;
+    if (primary.empty()) v6 = endpoint.address().is_v6();
+    if (endpoint.address().is_v6() == v6)
+      primary.push_back(endpoint);
+      else secondary.push_back(endpoint);
+  }
+  m_endpoints.clear();
+  for (size_t i = 0; i < primary.size() || i < secondary.size(); i++)
+  {
+    if (i < primary.size()) m_endpoints.push_back(primary[i]);
+    if (i < secondary.size()) m_endpoints.push_back(secondary[i]);
+  }
+  if (m_endpoints.empty())
+  {
+    auto self = shared_from_this();
+    m_service.post([self]() {
+      self->finish(self->m_lastError, SocketPtr());
+    });
+    return;
+  }
+  attempt();
+}
+
+void TcpConnector::cancel()
+{
+  if (!m_handler) return;
+  m_lastError = boost::asio::error::operation_aborted;
+  m_next = m_endpoints.size();
+  m_staggerTimer.cancel();
+  boost::system::error_code ec;
+  for (auto& socket: m_sockets) socket->close(ec);
+}
+
+void TcpConnector::attempt()
+{
+  if (!m_handler || (m_next >= m_endpoints.size())) return;
+  auto self = shared_from_this();
+  auto socket = std::make_shared<boost::asio::ip::tcp::socket>(m_service);
+  m_sockets.push_back(socket);
+  m_active++;
+  socket->async_connect(m_endpoints[m_next++],
+                        [self, socket](const boost::system::error_code& ec) {
+    self->m_active--;
+    if (!self->m_handler) return;
+    if (!ec)
+    {
+      self->finish(ec, socket);
+      return;
+    }
+    if (self->m_lastError != boost::asio::error::operation_aborted)
+      self->m_lastError = ec;
+    boost::system::error_code error;
+    socket->close(error);
+    if (self->m_next < self->m_endpoints.size())
+    {
+      // неудачная попытка не ждет интервала смещения
+      self->m_staggerTimer.cancel();
+      self->attempt();
+    }
+    else if (!self->m_active) self->finish(self->m_lastError, SocketPtr());
+  });
+  if (m_next < m_endpoints.size())
+  {
+    m_staggerTimer.expires_from_now(m_stagger);
+    m_staggerTimer.async_wait([self](const boost::system::error_code& ec) {
+      if (ec == boost::asio::error::operation_aborted) return;
+      self->attempt();
+    });
+  }
+}
+
+void TcpConnector::finish(const boost::system::error_code& ec, SocketPtr socket)
+{
+  Handler handler;
+  handler.swap(m_handler);
+  m_staggerTimer.cancel();
+  boost::system::error_code error;
+  for (auto& s: m_sockets)
+    if (s != socket) s->close(error);
+  m_sockets.clear();
+  if (handler) handler(ec, socket);
+}